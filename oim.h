@@ -2,6 +2,8 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/select.h>
@@ -9,10 +11,25 @@
 #include <linux/input.h>
 #include <pthread.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
 #include <alsa/asoundlib.h>
 #include <math.h>
 #include <assert.h>
+#include <limits.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <linux/futex.h>
+#include <dlfcn.h>
+#include <link.h>
+
+#include "oim_loop.h"
+#include "oim_tablet.h"
 
 #define OIM_PI (3.141592653589793)
 #define OIM_PI2 ((OIM_PI) * 2.0)
@@ -23,25 +40,794 @@
 
 struct oim_note_event {
 	uint8_t note;
+	uint8_t channel; // MIDI channel, 0-15
 	float velocity;
+	uint32_t frame; // offset into the block passed to process_fn
 };
 
+#define OIM_MAX_NOTE_EVENTS (256)
+
 struct oim_input {
 	float pen_x;
 	float pen_y;
 	float pen_pressure;
+	/* fingers on the touch surface, by slot; a finger keeps its slot
+	 * while it's down. bit i of touch_active is set while slot i is.
+	 * pressure is [0:1] if the device reports it, 1 otherwise, and 0
+	 * once the finger is lifted */
+	uint32_t touch_active;
+	float touch_x[OIM_MAX_TOUCHES];
+	float touch_y[OIM_MAX_TOUCHES];
+	float touch_pressure[OIM_MAX_TOUCHES];
+	float midi_cc[128]; // [0:1]
+	float midi_pitch_bend; // [-1:1]
+	/* ordered by frame; events that don't fit are held back until the
+	 * next block */
 	int n_note_events;
-	struct oim_note_event note_events[256];
+	struct oim_note_event note_events[OIM_MAX_NOTE_EVENTS];
 };
 
 typedef void (*oim_process_fn)(uint32_t sample_rate, uint32_t n_frames, float* buffer, void* usr, struct oim_input* input);
 
-#define OIM__MAX_POLLFD (32)
+/* layers. the process_fn passed to oim_run listens on --midi-channel;
+ * more can be added before calling it, e.g. one per MIDI channel
+ * (midi_channel 1-16, or 0 for all). each layer only sees the note
+ * events of its own channel. layers render in parallel, on a pool of
+ * --workers threads, and are summed into the output. oim_run's own
+ * process_fn may be NULL if there are layers */
+#define OIM_MAX_LAYERS (16)
+
+void oim_layer(unsigned int midi_channel, oim_process_fn process_fn, void* usr);
+
+/* planar layers, instead of interleaved ones, get one contiguous,
+ * 64-byte aligned array per channel; channels[j][i] is sample i of
+ * channel j. n_channels is OIM_N_CHANNELS, or 1 for a mono layer, which
+ * renders channels[0] only and is heard on every channel. when every
+ * layer is planar and mono, the whole engine is mono up to the device,
+ * where the one channel is copied into all of them */
+typedef void (*oim_planar_fn)(uint32_t sample_rate, uint32_t n_frames, float* const* channels, void* usr, struct oim_input* input);
+
+void oim_layer_planar(unsigned int midi_channel, int n_channels, oim_planar_fn fn, void* usr);
+void oim_run_planar(int oversample_ratio, int oversample_zero_crossings, int n_channels, oim_planar_fn fn, void* usr);
+
+/* hot reload. with --reload <path.so>, the main layer's function (the
+ * process_fn given to oim_run, or oim_run_planar's fn) comes from that
+ * shared object instead, which is loaded again whenever it's rewritten,
+ * and swapped in between two periods, with the devices left open. the
+ * object is the instrument itself, built with -DOIM_PLUGIN (`make
+ * pwmpen.so`), ending in OIM_EXPORT(process) or
+ * OIM_EXPORT_PLANAR(process), whichever matches the layer. the new
+ * function gets the same usr as the old one, so the state's layout has
+ * to stay the same, unless the object also exports
+ *
+ *   void* oim_reload(void* usr);   returns the new function's state,
+ *                                  made from the one in use, which is
+ *                                  still being rendered with, so it
+ *                                  mustn't be changed
+ *   void oim_retire(void* usr);    frees a state oim_reload returned,
+ *                                  once nothing renders with it
+ *
+ * neither is called on the audio thread */
+#ifdef OIM_PLUGIN
+#define OIM_EXPORT(fn) \
+	__attribute__((visibility("default"))) void oim_process(uint32_t sample_rate, uint32_t n_frames, float* buffer, void* usr, struct oim_input* input) \
+	{ fn(sample_rate, n_frames, buffer, usr, input); }
+#define OIM_EXPORT_PLANAR(fn) \
+	__attribute__((visibility("default"))) void oim_process_planar(uint32_t sample_rate, uint32_t n_frames, float* const* channels, void* usr, struct oim_input* input) \
+	{ fn(sample_rate, n_frames, channels, usr, input); }
+#else
+#define OIM_EXPORT(fn)
+#define OIM_EXPORT_PLANAR(fn)
+#endif
+
+/* fast math. polynomial approximations that are branchless, so loops
+ * calling them vectorize (given -fno-trapping-math, which the Makefile
+ * sets), unlike loops calling libm. error bounds, as
+ * measured over every float in the stated ranges:
+ *
+ *   oim_exp2(x)      relative error < 1.1e-7 for x in [-126:127], and
+ *                    exact at integers; clamped outside that
+ *   oim_sin2pi(p)    absolute error < 2.1e-7 for |p| < 2^16 cycles
+ *   oim_tanh(x)      absolute error < 1.4e-7
+ *   oim_note_hz(n)   relative error < 1.7e-7, exact at integer notes
+ *
+ * building with -DOIM_LIBM=1 swaps in libm instead, which is how `make
+ * bench` compares the two inside the instruments */
+
+static float oim__note_hz[128];
+
+static void oim__math_init()
+{
+	for (int i = 0; i < 128; i++) oim__note_hz[i] = 440.0 * pow(2.0, (double)(i - 69) / 12.0);
+}
+
+#if OIM_LIBM
+
+static inline float oim_exp2(float x) { return exp2f(x); }
+static inline float oim_sin2pi(float phase) { return sinf(phase * (float)OIM_PI2); }
+static inline float oim_sin(float x) { return sinf(x); }
+static inline float oim_tanh(float x) { return tanhf(x); }
+static inline float oim_note_hz(float note) { return 440.0f * powf(2.0f, (note - 69.0f) / 12.0f); }
+
+#else
+
+/* 2^x for x in [-0.5:0.5] is 1 + x*P(x), minimax for relative error */
+static inline float oim_exp2(float x)
+{
+	/* plain compares, unlike fminf and fmaxf, vectorize without
+	 * -ffast-math */
+	x = x < -126.0f ? -126.0f : x;
+	x = x > 127.0f ? 127.0f : x;
+	/* round to nearest; the offset keeps the truncation positive */
+	const int n = (int)(x + 128.5f) - 128;
+	const float f = x - (float)n;
+	float p = 0.00015469732f;
+	p = p * f + 0.0013410001f;
+	p = p * f + 0.0096180308f;
+	p = p * f + 0.055502973f;
+	p = p * f + 0.24022651f;
+	p = p * f + 0.69314723f;
+	p = p * f + 1.0f;
+	const uint32_t bits = (uint32_t)(n + 127) << 23;
+	float scale;
+	memcpy(&scale, &bits, sizeof scale);
+	return p * scale;
+}
+
+/* sin(2*pi*phase). phase is reduced to [-0.25:0.25] by symmetry, where
+ * an odd minimax polynomial takes over */
+static inline float oim_sin2pi(float phase)
+{
+	float q = phase - (float)(int)phase;
+	q = q > 0.5f ? q - 1.0f : q;
+	q = q < -0.5f ? q + 1.0f : q;
+	q = fabsf(q) > 0.25f ? copysignf(0.5f, q) - q : q;
+	const float q2 = q * q;
+	float p = 39.536706f;
+	p = p * q2 - 76.549782f;
+	p = p * q2 + 81.601004f;
+	p = p * q2 - 41.341655f;
+	p = p * q2 + 6.2831852f;
+	return p * q;
+}
+
+static inline float oim_sin(float x)
+{
+	return oim_sin2pi(x * (float)(1.0 / OIM_PI2));
+}
+
+/* (e^2x - 1) / (e^2x + 1); saturated beyond |x| = 9, where tanh is 1
+ * to within float precision */
+static inline float oim_tanh(float x)
+{
+	x = x < -9.0f ? -9.0f : x;
+	x = x > 9.0f ? 9.0f : x;
+	const float e = oim_exp2(x * 2.8853901f); // 2/ln(2)
+	return (e - 1.0f) / (e + 1.0f);
+}
+
+/* equal temperament, A4 (69) = 440Hz. fractional notes are fine tuning */
+static inline float oim_note_hz(float note)
+{
+	note = note < 0.0f ? 0.0f : note;
+	note = note > 127.0f ? 127.0f : note;
+	const int i = (int)note;
+	const float f = note - (float)i;
+	return oim__note_hz[i] * oim_exp2(f * (float)(1.0 / 12.0));
+}
+
+#endif
+
+/* band-limited oscillators, for instruments to use instead of naive
+ * waveforms, which alias no matter how much they're oversampled.
+ *
+ * phase is in cycles, [0:1), and dt is the phase advance per sample,
+ * i.e. hz / sample_rate, which must stay below 0.5. discontinuities are
+ * smoothed by two-sample polynomial residuals: PolyBLEP for steps, and
+ * its integral, PolyBLAMP, for kinks. what aliasing is left is mostly
+ * far below the fundamental, and 2x oversampling deals with the rest */
+
+/* residual of a step from -1 to 1 at phase 0, at phase t */
+static inline float oim__polyblep(float t, float dt)
+{
+	/* both sides are computed and one selected, without branches, so
+	 * loops over samples vectorize */
+	const float r = 1.0f / dt;
+	const float x0 = t * r;
+	const float x1 = (t - 1.0f) * r;
+	const float r0 = x0 + x0 - x0*x0 - 1.0f;
+	const float r1 = x1*x1 + x1 + x1 + 1.0f;
+	return t < dt ? r0 : t > (1.0f - dt) ? r1 : 0.0f;
+}
+
+/* residual of the slope increasing by 1 per sample at phase 0, at
+ * phase t */
+static inline float oim__polyblamp(float t, float dt)
+{
+	float x;
+	if (t < dt) {
+		x = 1.0f - t / dt;
+	} else if (t > (1.0f - dt)) {
+		x = 1.0f - (1.0f - t) / dt;
+	} else {
+		return 0;
+	}
+	return x * x * x * (1.0f / 6.0f);
+}
+
+/* for phase >= 0. truncating vectorizes on any x86-64, unlike floorf,
+ * which needs SSE4.1 */
+static inline float oim__phase_wrap(float phase)
+{
+	return phase - (float)(int)phase;
+}
+
+/* advances *phase by dt, and returns the phase before */
+static inline float oim_phase_advance(float* phase, float dt)
+{
+	float p = *phase;
+	float next = p + dt;
+	if (next >= 1.0f) next -= 1.0f;
+	*phase = next;
+	return p;
+}
+
+/* rising from -1 to 1, then dropping back at phase 0 */
+static inline float oim_osc_saw(float phase, float dt)
+{
+	return (2.0f * phase - 1.0f) - oim__polyblep(phase, dt);
+}
+
+/* 1 from phase 0 until duty, -1 for the rest */
+static inline float oim_osc_pulse(float phase, float dt, float duty)
+{
+	float y = phase < duty ? 1.0f : -1.0f;
+	return y + oim__polyblep(phase, dt) - oim__polyblep(oim__phase_wrap(phase - duty + 1.0f), dt);
+}
+
+/* -1 at phase 0, 1 at phase 0.5 */
+static inline float oim_osc_triangle(float phase, float dt)
+{
+	float y = 1.0f - 4.0f * fabsf(phase - 0.5f);
+	float k = 8.0f * dt;
+	return y + k * (oim__polyblamp(phase, dt) - oim__polyblamp(oim__phase_wrap(phase + 0.5f), dt));
+}
+
+/* fills out[0:n] with the phases of n samples, starting at *phase >= 0
+ * and advancing dt >= 0 per sample, and leaves *phase where the next
+ * block starts. unlike calling oim_phase_advance per sample, there's no
+ * dependency from one sample to the next, so it vectorizes */
+static inline void oim_phase_ramp(float* phase, float dt, float* out, int n)
+{
+	const float p = *phase;
+	for (int i = 0; i < n; i++) out[i] = oim__phase_wrap(p + (float)i * dt);
+	*phase = oim__phase_wrap(p + (float)n * dt);
+}
+
+/* parameter smoothing, and control rate.
+ *
+ * a smoother is a one-pole lowpass, y += (target - y) * (1 - a) per
+ * sample, with a = exp(-1 / (seconds * sample_rate)). within a block the
+ * target is constant, so sample i is target + (y - target) * a^(i+1),
+ * which is computed for 8 samples at a time without any dependency
+ * between them. once y is within OIM__SMOOTH_EPSILON of the target it
+ * snaps to it, so it never decays into subnormals.
+ *
+ * parameters that needn't change every sample (pitch, filter
+ * coefficients, wavetable levels) can instead be updated at control
+ * rate: once per OIM_KRATE_FRAMES frames, with oim_smooth_k */
+
+#define OIM_KRATE_FRAMES (32)
+#define OIM__SMOOTH_EPSILON (1e-6f)
+
+struct oim_smoother {
+	float y;
+	float seconds;
+	uint32_t sample_rate;
+	float a;
+	float log2_a;
+	float a8;
+	float ak; // a^OIM_KRATE_FRAMES
+	float powers[8]; // a^1 .. a^8
+};
+
+static inline void oim_smoother_init(struct oim_smoother* s, float y, float seconds)
+{
+	memset(s, 0, sizeof *s);
+	s->y = y;
+	s->seconds = seconds;
+}
+
+static inline void oim__smoother_prep(struct oim_smoother* s, uint32_t sample_rate)
+{
+	if (s->sample_rate == sample_rate) return;
+	s->sample_rate = sample_rate;
+	s->a = s->seconds > 0 ? expf(-1.0f / (s->seconds * (float)sample_rate)) : 0;
+	s->log2_a = s->seconds > 0 ? (-1.0f / (s->seconds * (float)sample_rate)) * (float)(1.0 / M_LN2) : -126.0f;
+	float x = 1.0f;
+	for (int i = 0; i < 8; i++) s->powers[i] = (x *= s->a);
+	s->a8 = s->powers[7];
+	s->ak = powf(s->a, OIM_KRATE_FRAMES);
+}
+
+/* audio rate; fills out[0:n] with the next n values */
+static inline void oim_smooth(struct oim_smoother* s, uint32_t sample_rate, float target, float* out, int n)
+{
+	if (n <= 0) return;
+	oim__smoother_prep(s, sample_rate);
+	float d = s->y - target;
+	if (fabsf(d) < OIM__SMOOTH_EPSILON) {
+		s->y = target;
+		for (int i = 0; i < n; i++) out[i] = target;
+		return;
+	}
+	int i = 0;
+	for (; (i + 8) <= n; i += 8) {
+		for (int j = 0; j < 8; j++) out[i+j] = target + d * s->powers[j];
+		d *= s->a8;
+	}
+	for (int j = 0; i < n; i++, j++) out[i] = target + d * s->powers[j];
+	s->y = out[n-1];
+}
+
+/* control rate; advances n samples, and returns the value at the start
+ * of them */
+static inline float oim_smooth_k(struct oim_smoother* s, uint32_t sample_rate, float target, int n)
+{
+	oim__smoother_prep(s, sample_rate);
+	const float y = s->y;
+	const float d = y - target;
+	if (fabsf(d) < OIM__SMOOTH_EPSILON) {
+		s->y = target;
+	} else {
+		s->y = target + d * (n == OIM_KRATE_FRAMES ? s->ak : oim_exp2(s->log2_a * (float)n));
+	}
+	return y;
+}
+
+/* polyphonic voices. a fixed pool of voices, stored as a structure of
+ * arrays, so that OIM_VOICE_LANES voices render together, one per SIMD
+ * lane, and the cost grows per group of lanes rather than per voice.
+ *
+ * sounding voices are kept packed at the front of the arrays; a freed
+ * voice is replaced by the last one. each voice is on one of two lists,
+ * held or released, in note on order, so allocating, releasing and
+ * stealing are all O(1): a note on takes a free voice if there is one,
+ * else the oldest released, else the oldest held. nothing allocates and
+ * nothing sorts, so it's all safe to call from process_fn.
+ *
+ * a voice's level follows a one-pole envelope, towards its velocity
+ * while held and towards 0 once released, and it's freed when it gets
+ * there. the envelope runs at control rate and is interpolated linearly
+ * in between, and phases are computed from the start of the block, so
+ * that no sample depends on the one before it */
+
+#ifndef OIM_MAX_VOICES
+#define OIM_MAX_VOICES (64)
+#endif
+#define OIM_VOICE_LANES (8)
+#define OIM__VOICE_SILENT (1e-4f)
+
+#if (OIM_MAX_VOICES % OIM_VOICE_LANES) != 0 || OIM_MAX_VOICES > 32767
+#error "OIM_MAX_VOICES must be a multiple of OIM_VOICE_LANES"
+#endif
+
+struct oim__voice_list {
+	int16_t head, tail; // oldest, newest; -1 when empty
+};
+
+struct oim_voices {
+	/* per voice; [n:OIM_MAX_VOICES] is kept silent, so that partial
+	 * groups of lanes can be rendered as full ones */
+	float phase[OIM_MAX_VOICES] __attribute__((aligned(64)));
+	float hz[OIM_MAX_VOICES] __attribute__((aligned(64)));
+	float level[OIM_MAX_VOICES] __attribute__((aligned(64)));
+	float target[OIM_MAX_VOICES] __attribute__((aligned(64)));
+	float log2_a[OIM_MAX_VOICES] __attribute__((aligned(64))); // envelope decay per sample
+	uint8_t note[OIM_MAX_VOICES];
+	uint8_t held[OIM_MAX_VOICES];
+	int16_t prev[OIM_MAX_VOICES], next[OIM_MAX_VOICES];
+	int n;
+
+	struct oim__voice_list held_list, released_list;
+	int16_t by_note[128]; // voice sounding the note, or -1
+
+	float attack, release; // seconds
+	uint32_t sample_rate;
+	float attack_log2_a, release_log2_a;
+};
+
+static inline void oim_voices_init(struct oim_voices* v, float attack, float release)
+{
+	memset(v, 0, sizeof *v);
+	v->held_list.head = v->held_list.tail = -1;
+	v->released_list.head = v->released_list.tail = -1;
+	for (int i = 0; i < 128; i++) v->by_note[i] = -1;
+	v->attack = attack;
+	v->release = release;
+}
+
+static inline void oim__voices_prep(struct oim_voices* v, uint32_t sample_rate)
+{
+	if (v->sample_rate == sample_rate) return;
+	v->sample_rate = sample_rate;
+	v->attack_log2_a = v->attack > 0 ? (-1.0f / (v->attack * (float)sample_rate)) * (float)(1.0 / M_LN2) : -126.0f;
+	v->release_log2_a = v->release > 0 ? (-1.0f / (v->release * (float)sample_rate)) * (float)(1.0 / M_LN2) : -126.0f;
+	for (int i = 0; i < v->n; i++) v->log2_a[i] = v->held[i] ? v->attack_log2_a : v->release_log2_a;
+}
+
+static inline void oim__voice_list_append(struct oim_voices* v, struct oim__voice_list* l, int i)
+{
+	v->prev[i] = l->tail;
+	v->next[i] = -1;
+	if (l->tail >= 0) v->next[l->tail] = i; else l->head = i;
+	l->tail = i;
+}
+
+static inline void oim__voice_list_remove(struct oim_voices* v, struct oim__voice_list* l, int i)
+{
+	if (v->prev[i] >= 0) v->next[v->prev[i]] = v->next[i]; else l->head = v->next[i];
+	if (v->next[i] >= 0) v->prev[v->next[i]] = v->prev[i]; else l->tail = v->prev[i];
+}
+
+static inline struct oim__voice_list* oim__voice_list_of(struct oim_voices* v, int i)
+{
+	return v->held[i] ? &v->held_list : &v->released_list;
+}
+
+/* frees voice i by moving the last voice into its place; returns the old
+ * index of the voice that moved */
+static inline int oim__voices_free(struct oim_voices* v, int i)
+{
+	oim__voice_list_remove(v, oim__voice_list_of(v, i), i);
+	v->by_note[v->note[i]] = -1;
+
+	const int last = --v->n;
+	if (i != last) {
+		struct oim__voice_list* l = oim__voice_list_of(v, last);
+		v->phase[i] = v->phase[last];
+		v->hz[i] = v->hz[last];
+		v->level[i] = v->level[last];
+		v->target[i] = v->target[last];
+		v->log2_a[i] = v->log2_a[last];
+		v->note[i] = v->note[last];
+		v->held[i] = v->held[last];
+		v->prev[i] = v->prev[last];
+		v->next[i] = v->next[last];
+		if (v->prev[i] >= 0) v->next[v->prev[i]] = i; else l->head = i;
+		if (v->next[i] >= 0) v->prev[v->next[i]] = i; else l->tail = i;
+		v->by_note[v->note[i]] = i;
+	}
+	v->phase[last] = v->hz[last] = v->level[last] = v->target[last] = v->log2_a[last] = 0;
+	return last;
+}
+
+/* starts note, or restarts it if it's still sounding */
+static inline void oim_voices_note_on(struct oim_voices* v, uint32_t sample_rate, uint8_t note, float velocity)
+{
+	oim__voices_prep(v, sample_rate);
+	note &= 0x7f;
+	int i = v->by_note[note];
+	if (i >= 0) {
+		oim__voice_list_remove(v, oim__voice_list_of(v, i), i);
+	} else {
+		if (v->n < OIM_MAX_VOICES) {
+			i = v->n++;
+		} else {
+			/* stolen voices keep their level, and ramp from there */
+			i = v->released_list.head >= 0 ? v->released_list.head : v->held_list.head;
+			oim__voice_list_remove(v, oim__voice_list_of(v, i), i);
+			v->by_note[v->note[i]] = -1;
+		}
+		v->phase[i] = 0;
+		v->note[i] = note;
+		v->by_note[note] = i;
+	}
+	v->hz[i] = oim_note_hz(note);
+	v->target[i] = velocity;
+	v->log2_a[i] = v->attack_log2_a;
+	v->held[i] = 1;
+	oim__voice_list_append(v, &v->held_list, i);
+}
+
+static inline void oim_voices_note_off(struct oim_voices* v, uint8_t note)
+{
+	const int i = v->by_note[note & 0x7f];
+	if (i < 0 || !v->held[i]) return;
+	oim__voice_list_remove(v, &v->held_list, i);
+	v->held[i] = 0;
+	v->target[i] = 0;
+	v->log2_a[i] = v->release_log2_a;
+	oim__voice_list_append(v, &v->released_list, i);
+}
+
+static inline void oim_voices_note_event(struct oim_voices* v, uint32_t sample_rate, struct oim_note_event ev)
+{
+	if (ev.velocity > 0) {
+		oim_voices_note_on(v, sample_rate, ev.note, ev.velocity);
+	} else {
+		oim_voices_note_off(v, ev.note);
+	}
+}
+
+typedef float (*oim_voice_osc_fn)(float phase, float dt, float param);
+
+/* adds the sum of all voices to out[0:n], n <= OIM_KRATE_FRAMES. osc is
+ * called with param[i] at sample i; it's inlined, so it should be
+ * branchless for the lanes to vectorize. pitch multiplies every voice's
+ * frequency, e.g. for pitch bend. released voices that have faded out
+ * are freed afterwards */
+static inline __attribute__((always_inline)) void oim_voices_render(struct oim_voices* v, uint32_t sample_rate, oim_voice_osc_fn osc, float pitch, const float* param, float* out, int n)
+{
+	assert(n <= OIM_KRATE_FRAMES);
+	if (n <= 0) return;
+	oim__voices_prep(v, sample_rate);
+	const float to_dt = pitch / (float)sample_rate;
+	const float inv_n = 1.0f / (float)n;
+
+	float acc[OIM_KRATE_FRAMES][OIM_VOICE_LANES] __attribute__((aligned(64)));
+	memset(acc, 0, sizeof acc);
+
+	for (int g = 0; g < v->n; g += OIM_VOICE_LANES) {
+		float phase[OIM_VOICE_LANES], dt[OIM_VOICE_LANES], level[OIM_VOICE_LANES], slope[OIM_VOICE_LANES];
+		for (int j = 0; j < OIM_VOICE_LANES; j++) {
+			phase[j] = v->phase[g+j];
+			dt[j] = v->hz[g+j] * to_dt;
+			level[j] = v->level[g+j];
+			const float end = v->target[g+j] + (level[j] - v->target[g+j]) * oim_exp2(v->log2_a[g+j] * (float)n);
+			slope[j] = (end - level[j]) * inv_n;
+		}
+		for (int i = 0; i < n; i++) {
+			const float x = param[i];
+			const float fi = (float)i;
+			for (int j = 0; j < OIM_VOICE_LANES; j++) {
+				const float p = oim__phase_wrap(phase[j] + fi * dt[j]);
+				acc[i][j] += osc(p, dt[j], x) * (level[j] + slope[j] * (fi + 1.0f));
+			}
+		}
+		for (int j = 0; j < OIM_VOICE_LANES; j++) {
+			v->phase[g+j] = oim__phase_wrap(phase[j] + (float)n * dt[j]);
+			v->level[g+j] = level[j] + slope[j] * (float)n;
+		}
+	}
+
+	for (int i = 0; i < n; i++) {
+		float sum = 0;
+		for (int j = 0; j < OIM_VOICE_LANES; j++) sum += acc[i][j];
+		out[i] += sum;
+	}
+
+	for (int i = v->released_list.head; i >= 0; ) {
+		int next = v->next[i];
+		if (v->level[i] < OIM__VOICE_SILENT) {
+			if (oim__voices_free(v, i) == next) next = i;
+		}
+		i = next;
+	}
+}
+
+#define OIM__DEFAULT_SAMPLE_RATE (48000)
+#define OIM__DEFAULT_PERIOD_SIZE (256)
+
+/* runtime configuration. every setting has an environment variable,
+ * and a command line option if the program passes its arguments to
+ * oim_args (options win over the environment) */
+
+struct oim__config {
+	const char* backend;
+	const char* pcm;
+	const char* midi;
+	const char* midi_seq;
+	unsigned int midi_channel;
+	unsigned int sample_rate;
+	snd_pcm_uframes_t period_size;
+	unsigned int n_periods;
+	int adaptive;
+	snd_pcm_uframes_t adaptive_min;
+	snd_pcm_uframes_t adaptive_max;
+	int mmap;
+	const char* format;
+	int dither;
+	int input_thread;
+	int rt_priority;
+	int n_workers; // -1 for one per layer, up to the cores
+	const char* stats_shm;
+	unsigned int stats_interval;
+	const char* wavetable_cache;
+	const char* capture;
+	const char* replay;
+	double replay_speed;
+	const char* reload;
+	int huge_pages;
+};
+
+static struct oim__config oim__config;
+static int oim__config_ready;
+
+struct oim__config_option {
+	const char* option;
+	const char* env;
+	char type; // s=string, u=unsigned, f=float, b=flag
+	size_t offset;
+	const char* help;
+};
+
+#define OIM__CONFIG_FIELD(f) offsetof(struct oim__config, f)
+
+static const struct oim__config_option oim__config_options[] = {
+	{ "--backend",      "OIM_BACKEND",      's', OIM__CONFIG_FIELD(backend),      "audio output: alsa, null, wav:<path> or shm:<name> (alsa)" },
+	{ "--pcm",          "OIM_PCM",          's', OIM__CONFIG_FIELD(pcm),          "ALSA pcm name (default)" },
+	{ "--midi",         "OIM_MIDI",         's', OIM__CONFIG_FIELD(midi),         "ALSA rawmidi port (hw:1,0,0)" },
+	{ "--midi-seq",     "OIM_MIDI_SEQ",     's', OIM__CONFIG_FIELD(midi_seq),     "also take ALSA sequencer input from this client:port (none to only create the port)" },
+	{ "--midi-channel", "OIM_MIDI_CHANNEL", 'u', OIM__CONFIG_FIELD(midi_channel), "MIDI channel for notes to the main layer, and for controls, 1-16, or 0 for all (1)" },
+	{ "--rate",         "OIM_RATE",         'u', OIM__CONFIG_FIELD(sample_rate),  "sample rate (48000)" },
+	{ "--period",       "OIM_PERIOD",       'u', OIM__CONFIG_FIELD(period_size),  "period size in frames (256)" },
+	{ "--periods",      "OIM_PERIODS",      'u', OIM__CONFIG_FIELD(n_periods),    "periods per buffer (3)" },
+	{ "--adaptive",     "OIM_ADAPTIVE",     'b', OIM__CONFIG_FIELD(adaptive),     "adapt the period size to xruns" },
+	{ "--adaptive-min", "OIM_ADAPTIVE_MIN", 'u', OIM__CONFIG_FIELD(adaptive_min), "smallest adaptive period size (32)" },
+	{ "--adaptive-max", "OIM_ADAPTIVE_MAX", 'u', OIM__CONFIG_FIELD(adaptive_max), "largest adaptive period size (2048)" },
+	{ "--mmap",         "OIM_MMAP",         'b', OIM__CONFIG_FIELD(mmap),         "render straight into the device buffer" },
+	{ "--format",       "OIM_FORMAT",       's', OIM__CONFIG_FIELD(format),       "ALSA sample format: float, s32, s24_3 or s16, or auto for the first of those the device takes (auto)" },
+	{ "--dither",       "OIM_DITHER",       'b', OIM__CONFIG_FIELD(dither),       "TPDF dither integer ALSA formats" },
+	{ "--input-thread", "OIM_INPUT_THREAD", 'b', OIM__CONFIG_FIELD(input_thread), "handle input on a thread of its own" },
+	{ "--rt-priority",  "OIM_RT_PRIORITY",  'u', OIM__CONFIG_FIELD(rt_priority),  "SCHED_FIFO priority of the audio thread (70)" },
+	{ "--workers",      "OIM_WORKERS",      'u', OIM__CONFIG_FIELD(n_workers),    "threads rendering layers besides the audio thread; 0 renders them all on it (one per layer, up to the cores)" },
+	{ "--stats",        "OIM_STATS",        'u', OIM__CONFIG_FIELD(stats_interval), "print a stats line every n seconds" },
+	{ "--stats-shm",    "OIM_STATS_SHM",    's', OIM__CONFIG_FIELD(stats_shm),    "publish stats in this shm object, e.g. /oim" },
+	{ "--capture",      "OIM_CAPTURE",      's', OIM__CONFIG_FIELD(capture),      "append all input to this file, for --replay" },
+	{ "--replay",       "OIM_REPLAY",       's', OIM__CONFIG_FIELD(replay),       "play input back from a --capture file instead of the devices" },
+	{ "--replay-speed", "OIM_REPLAY_SPEED", 'f', OIM__CONFIG_FIELD(replay_speed), "replay this many times faster, or 0 for as fast as possible (1)" },
+	{ "--huge-pages",   "OIM_HUGE_PAGES",   'b', OIM__CONFIG_FIELD(huge_pages),   "back the audio path's memory with transparent huge pages" },
+	{ "--reload",       "OIM_RELOAD",       's', OIM__CONFIG_FIELD(reload),       "take the main layer's function from this shared object, and reload it when it changes" },
+	{ "--wavetable-cache", "OIM_WAVETABLE_CACHE", 's', OIM__CONFIG_FIELD(wavetable_cache), "wavetable cache file (~/.cache/oim/wavetables.bin)" },
+	{ NULL }
+};
+
+static void oim__config_set(const struct oim__config_option* opt, const char* value)
+{
+	void* p = (uint8_t*)&oim__config + opt->offset;
+	char* end;
+	unsigned long v;
+	switch (opt->type) {
+	case 's':
+		*(const char**)p = value;
+		break;
+	case 'b':
+		*(int*)p = value == NULL || atoi(value) != 0;
+		break;
+	case 'f':
+		*(double*)p = strtod(value, &end);
+		if (*value == 0 || *end != 0) {
+			fprintf(stderr, "%s/%s: not a number: %s\n", opt->option, opt->env, value);
+			exit(EXIT_FAILURE);
+		}
+		break;
+	case 'u':
+		v = strtoul(value, &end, 10);
+		if (*value == 0 || *end != 0) {
+			fprintf(stderr, "%s/%s: not a number: %s\n", opt->option, opt->env, value);
+			exit(EXIT_FAILURE);
+		}
+		if (opt->offset == OIM__CONFIG_FIELD(period_size) || opt->offset == OIM__CONFIG_FIELD(adaptive_min) || opt->offset == OIM__CONFIG_FIELD(adaptive_max)) {
+			*(snd_pcm_uframes_t*)p = v;
+		} else if (opt->offset == OIM__CONFIG_FIELD(rt_priority) || opt->offset == OIM__CONFIG_FIELD(n_workers)) {
+			*(int*)p = v;
+		} else {
+			*(unsigned int*)p = v;
+		}
+		break;
+	}
+}
+
+/* values that would otherwise only fail later, and less clearly, in
+ * ALSA or the MIDI filter. checked once the options are in, when
+ * rendering starts */
+static void oim__config_range(size_t offset, unsigned long v, unsigned long min, unsigned long max)
+{
+	if (v >= min && v <= max) return;
+	const struct oim__config_option* opt = oim__config_options;
+	while (opt->offset != offset) opt++;
+	if (max == UINT_MAX) fprintf(stderr, "%s/%s: %lu; must be at least %lu\n", opt->option, opt->env, v, min);
+	else fprintf(stderr, "%s/%s: %lu; must be %lu-%lu\n", opt->option, opt->env, v, min, max);
+	exit(EXIT_FAILURE);
+}
+
+static void oim__config_check()
+{
+	oim__config_range(OIM__CONFIG_FIELD(midi_channel), oim__config.midi_channel, 0, 16);
+	oim__config_range(OIM__CONFIG_FIELD(sample_rate), oim__config.sample_rate, 1, UINT_MAX);
+	oim__config_range(OIM__CONFIG_FIELD(period_size), oim__config.period_size, 1, UINT_MAX);
+	oim__config_range(OIM__CONFIG_FIELD(n_periods), oim__config.n_periods, 1, UINT_MAX);
+}
+
+static void oim__config_init()
+{
+	if (oim__config_ready) return;
+	oim__config_ready = 1;
+
+	oim__config.backend = "alsa";
+	oim__config.pcm = "default";
+	oim__config.format = "auto";
+	oim__config.midi = "hw:1,0,0";
+	oim__config.midi_channel = 1;
+	oim__config.sample_rate = OIM__DEFAULT_SAMPLE_RATE;
+	oim__config.period_size = OIM__DEFAULT_PERIOD_SIZE;
+	oim__config.n_periods = 3;
+	oim__config.adaptive_min = 32;
+	oim__config.adaptive_max = 2048;
+	oim__config.rt_priority = 70;
+	oim__config.n_workers = -1;
+	oim__config.replay_speed = 1.0;
+
+	for (const struct oim__config_option* opt = oim__config_options; opt->option != NULL; opt++) {
+		const char* value = getenv(opt->env);
+		if (value != NULL) oim__config_set(opt, value);
+	}
+}
+
+static void oim__usage(const char* argv0)
+{
+	fprintf(stderr, "usage: %s [options]\n", argv0);
+	for (const struct oim__config_option* opt = oim__config_options; opt->option != NULL; opt++) {
+		char left[64];
+		snprintf(left, sizeof left, "%s%s", opt->option, opt->type == 'b' ? "" : " <value>");
+		fprintf(stderr, "  %-24s %-18s %s\n", left, opt->env, opt->help);
+	}
+}
+
+/* parses command line options; exits with a usage message on anything
+ * it doesn't know */
+void oim_args(int argc, char** argv)
+{
+	oim__config_init();
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+			oim__usage(argv[0]);
+			exit(EXIT_SUCCESS);
+		}
+		const struct oim__config_option* opt = oim__config_options;
+		for (; opt->option != NULL; opt++) {
+			if (strcmp(argv[i], opt->option) == 0) break;
+		}
+		if (opt->option == NULL) {
+			fprintf(stderr, "unknown option: %s\n", argv[i]);
+			oim__usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		if (opt->type == 'b') {
+			oim__config_set(opt, NULL);
+		} else if ((i+1) < argc) {
+			oim__config_set(opt, argv[++i]);
+		} else {
+			fprintf(stderr, "%s: missing value\n", opt->option);
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+/* sample formats, in the order --format auto tries them. integer ones
+ * are quantized by oim, rather than left to a plug pcm */
+struct oim__format {
+	const char* name;
+	snd_pcm_format_t format;
+	int bits; // 0 for float
+};
+
+static const struct oim__format oim__formats[] = {
+	{ "float", SND_PCM_FORMAT_FLOAT_LE, 0 },
+	{ "s32",   SND_PCM_FORMAT_S32_LE,   32 },
+	{ "s24_3", SND_PCM_FORMAT_S24_3LE,  24 },
+	{ "s16",   SND_PCM_FORMAT_S16_LE,   16 },
+	{ NULL }
+};
 
-static void oim__prep_audio(snd_pcm_t** pcm, int* n_pollfds, struct pollfd* pollfds, unsigned int* sample_rate, snd_pcm_uframes_t* period_size)
+/* *period_size is the wanted period size on open, and the actual one
+ * after. *mmap_access is whether to try SND_PCM_ACCESS_MMAP_INTERLEAVED
+ * on open, and is cleared if the device refuses it */
+static void oim__open_pcm(snd_pcm_t** pcm, unsigned int* sample_rate, snd_pcm_uframes_t* period_size, snd_pcm_uframes_t* buffer_size, int* mmap_access, int* bits)
 {
 	if (*pcm == NULL) {
-		char *pcm_name = "default"; // TODO override set via env?
+		const char* pcm_name = oim__config.pcm;
 
 		int err = snd_pcm_open(pcm, pcm_name, SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK);
 		if (err < 0) return;
@@ -56,19 +842,36 @@ static void oim__prep_audio(snd_pcm_t** pcm, int* n_pollfds, struct pollfd* poll
 			return;
 		}
 
-		if ((err = snd_pcm_hw_params_set_access(*pcm, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
+		if (*mmap_access && (err = snd_pcm_hw_params_set_access(*pcm, hw_params, SND_PCM_ACCESS_MMAP_INTERLEAVED)) < 0) {
+			fprintf(stderr, "snd_pcm_hw_params_set_access (mmap): %s; falling back to rw\n", snd_strerror(err));
+			*mmap_access = 0;
+		}
+
+		if (!*mmap_access && (err = snd_pcm_hw_params_set_access(*pcm, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
 			fprintf(stderr, "snd_pcm_hw_params_set_access: %s\n", snd_strerror(err));
 			snd_pcm_close(*pcm);
 			*pcm = NULL;
 			return;
 		}
 
-		if ((err = snd_pcm_hw_params_set_format(*pcm, hw_params, SND_PCM_FORMAT_FLOAT_LE)) < 0) {
+		const struct oim__format* format = NULL;
+		for (const struct oim__format* f = oim__formats; format == NULL && f->name != NULL; f++) {
+			if (strcmp(oim__config.format, "auto") != 0 && strcmp(oim__config.format, f->name) != 0) continue;
+			if (snd_pcm_hw_params_test_format(*pcm, hw_params, f->format) == 0) format = f;
+		}
+		if (format == NULL) {
+			fprintf(stderr, "snd_pcm_hw_params_set_format: no format for --format %s\n", oim__config.format);
+			snd_pcm_close(*pcm);
+			*pcm = NULL;
+			return;
+		}
+		if ((err = snd_pcm_hw_params_set_format(*pcm, hw_params, format->format)) < 0) {
 			fprintf(stderr, "snd_pcm_hw_params_set_format: %s\n", snd_strerror(err));
 			snd_pcm_close(*pcm);
 			*pcm = NULL;
 			return;
 		}
+		*bits = format->bits;
 
 		if ((err = snd_pcm_hw_params_set_channels(*pcm, hw_params, OIM_N_CHANNELS)) < 0) {
 			fprintf(stderr, "snd_pcm_hw_params_set_channels: %s\n", snd_strerror(err));
@@ -77,7 +880,7 @@ static void oim__prep_audio(snd_pcm_t** pcm, int* n_pollfds, struct pollfd* poll
 			return;
 		}
 
-		*sample_rate = 48000;
+		*sample_rate = oim__config.sample_rate;
 		if ((err = snd_pcm_hw_params_set_rate_near(*pcm, hw_params, sample_rate, 0)) < 0) {
 			fprintf(stderr, "snd_pcm_hw_params_set_rate_near: %s\n", snd_strerror(err));
 			snd_pcm_close(*pcm);
@@ -85,7 +888,6 @@ static void oim__prep_audio(snd_pcm_t** pcm, int* n_pollfds, struct pollfd* poll
 			return;
 		}
 
-		*period_size = 256;
 		if ((err = snd_pcm_hw_params_set_period_size_near(*pcm, hw_params, period_size, 0)) < 0) {
 			fprintf(stderr, "snd_pcm_hw_params_set_period_size_near: %s\n", snd_strerror(err));
 			snd_pcm_close(*pcm);
@@ -93,8 +895,8 @@ static void oim__prep_audio(snd_pcm_t** pcm, int* n_pollfds, struct pollfd* poll
 			return;
 		}
 
-		snd_pcm_uframes_t buffer_size = *period_size * 3;
-		if ((err = snd_pcm_hw_params_set_buffer_size_near(*pcm, hw_params, &buffer_size)) < 0) {
+		*buffer_size = *period_size * oim__config.n_periods;
+		if ((err = snd_pcm_hw_params_set_buffer_size_near(*pcm, hw_params, buffer_size)) < 0) {
 			fprintf(stderr, "snd_pcm_hw_params_set_buffer_size_near: %s\n", snd_strerror(err));
 			snd_pcm_close(*pcm);
 			*pcm = NULL;
@@ -108,67 +910,77 @@ static void oim__prep_audio(snd_pcm_t** pcm, int* n_pollfds, struct pollfd* poll
 			return;
 		}
 
-		fprintf(stderr, "pcm open; sample rate = %u; period size = %lu; buffer size = %lu\n",
+		fprintf(stderr, "pcm open; sample rate = %u; period size = %lu; buffer size = %lu; access = %s; format = %s\n",
 			*sample_rate,
 			*period_size,
-			buffer_size);
-	}
-
-	if (*pcm == NULL) {
-		return;
+			*buffer_size,
+			*mmap_access ? "mmap" : "rw",
+			format->name);
 	}
-
-	*n_pollfds += snd_pcm_poll_descriptors(*pcm, &pollfds[*n_pollfds], OIM__MAX_POLLFD - *n_pollfds);
 }
 
-static void oim__prep_rawmidi_for_poll(snd_rawmidi_t** rawmidi, int* n_pollfds, struct pollfd* pollfds) {
-	const char* port = "hw:1,0,0"; // XXX can I use a better name?
+static void oim__open_rawmidi(struct oim_loop* loop, struct oim_source* src, snd_rawmidi_t** rawmidi) {
+	const char* port = oim__config.midi;
 
-	if (*rawmidi == NULL) {
-		int err = snd_rawmidi_open(rawmidi, NULL, port, SND_RAWMIDI_NONBLOCK);
-		if (err < 0) return;
-		fprintf(stderr, "midi open -> %p\n", *rawmidi);
-	}
-	if (*rawmidi == NULL) {
+	if (*rawmidi != NULL) return;
+	int err = snd_rawmidi_open(rawmidi, NULL, port, SND_RAWMIDI_NONBLOCK);
+	if (err < 0) {
+		*rawmidi = NULL;
 		return;
 	}
-	*n_pollfds += snd_rawmidi_poll_descriptors(*rawmidi, &pollfds[*n_pollfds], OIM__MAX_POLLFD - *n_pollfds);
+	fprintf(stderr, "midi open -> %p\n", *rawmidi);
+	src->n_fds = snd_rawmidi_poll_descriptors(*rawmidi, src->fds, OIM_SOURCE_MAX_FDS);
+	oim_loop_add(loop, src);
 }
 
-static void oim__prep_fd_at_path_for_poll(int* fd, const char* path, int* n_pollfds, struct pollfd* pollfds) {
-	if (*fd == -1) {
-		*fd = open(path, O_RDONLY);
-		if (*fd != -1) fprintf(stderr, "open %s -> %d\n", path, *fd);
-	}
-	if (*fd >= 0) {
-		pollfds[*n_pollfds].fd = *fd;
-		pollfds[*n_pollfds].events = POLLIN;
-		(*n_pollfds)++;
-	}
+static void oim__close_rawmidi(struct oim_loop* loop, struct oim_source* src, snd_rawmidi_t** rawmidi) {
+	oim_loop_remove(loop, src);
+	snd_rawmidi_close(*rawmidi);
+	*rawmidi = NULL;
 }
 
-static inline int oim__handle_input_event(int* fd, struct pollfd* event, struct input_event* ev) {
-	if (event->fd != *fd) return 0;
+#define OIM__MAX_INPUT_EVENTS (64)
+
+/* reads every pending event (up to max) in one go; evdev only ever
+ * hands out whole events, and at least one once the fd polls readable.
+ * returns the number of events read */
+static inline int oim__handle_input_events(struct oim_loop* loop, struct oim_source* src, int* fd, struct input_event* evs, int max) {
+	if (*fd == -1) return 0;
 
-	if (event->revents & (POLLERR | POLLHUP)) {
+	const short revents = src->fds[0].revents;
+	if (revents & (POLLERR | POLLHUP)) {
 		fprintf(stderr, "input event fd=%d HUP\n", *fd);
-		close(*fd);
-		*fd = -1;
+		oim_loop_close_fd(loop, src, fd);
 		return 0;
-	} else if (!(event->revents & POLLIN)) {
+	} else if (!(revents & POLLIN)) {
 		return 0;
 	}
 
-	int n = read(*fd, ev, sizeof *ev);
-	if (n != sizeof *ev) {
+	ssize_t n = read(*fd, evs, max * sizeof *evs);
+	if (n <= 0 || (n % sizeof *evs) != 0) {
 		fprintf(stderr, "input event fd=%d read error: %s\n", *fd, n == -1 ? strerror(errno) : "wrong size");
-		close(*fd);
+		oim_loop_close_fd(loop, src, fd);
 		return 0;
 	} else {
-		return 1;
+		return n / sizeof *evs;
+	}
+}
+
+/* copies the dirty slots out, and clears them */
+static void oim__touch_frame_apply(struct oim_touch_frame* f, struct oim_input* input)
+{
+	input->touch_active = f->active;
+	for (uint32_t d = f->dirty; d != 0; d &= d - 1) {
+		const int i = __builtin_ctz(d);
+		const int down = (f->active >> i) & 1;
+		input->touch_x[i] = f->x[i];
+		input->touch_y[i] = f->y[i];
+		input->touch_pressure[i] = down ? (f->has_pressure ? f->pressure[i] : 1.0f) : 0.0f;
 	}
+	f->dirty = 0;
 }
 
+
 static double oim__bessel_I0(double x)
 {
 	double d = 0.0;
@@ -201,276 +1013,4485 @@ static float* oim__alloc_float_array(int n)
 	return r;
 }
 
-void oim_run(int oversample_ratio, int oversample_zero_crossings, oim_process_fn process_fn, void* process_fn_usr)
-{
-	assert(oversample_ratio >= 1);
-
-	int err;
+/* the audio path's memory. everything an engine renders with comes out
+ * of one arena: a single anonymous mapping, handed out 64-byte aligned,
+ * which only reserves address space while the engine is being built,
+ * and is then cut down to what was used. a realtime engine's arena is
+ * also locked, which prefaults it, so the first periods don't page
+ * fault; with --huge-pages it's backed by transparent huge pages */
 
-	int fd_pen = -1;
-	int fd_touch = -1;
-	int fd_padbtns = -1;
+#define OIM__ARENA_RESERVE ((size_t)1 << 28)
+#define OIM__HUGE_PAGE_SZ ((size_t)2 << 20)
 
-	snd_pcm_t* pcm = NULL;
-	snd_rawmidi_t* rawmidi = NULL;
+struct oim__arena {
+	uint8_t* base;
+	size_t used;
+	size_t size;
+};
 
-	float* buffer = oim__alloc_float_array(1<<20);
-	float* tmp_buffer = oim__alloc_float_array(1<<20);
+static void oim__arena_init(struct oim__arena* a)
+{
+	/* aligned to a huge page, so the first one can be one */
+	const size_t sz = OIM__ARENA_RESERVE + OIM__HUGE_PAGE_SZ;
+	uint8_t* p = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED) {
+		perror("mmap arena");
+		exit(EXIT_FAILURE);
+	}
+	const size_t head = (OIM__HUGE_PAGE_SZ - ((uintptr_t)p & (OIM__HUGE_PAGE_SZ - 1))) & (OIM__HUGE_PAGE_SZ - 1);
+	if (head > 0) munmap(p, head);
+	munmap(p + head + OIM__ARENA_RESERVE, OIM__HUGE_PAGE_SZ - head);
 
-	struct oim_input input;
-	memset(&input, 0, sizeof input);
+	a->base = p + head;
+	a->used = 0;
+	a->size = OIM__ARENA_RESERVE;
+	if (oim__config.huge_pages && madvise(a->base, a->size, MADV_HUGEPAGE) != 0) {
+		fprintf(stderr, "madvise MADV_HUGEPAGE: %s; continuing without\n", strerror(errno));
+	}
+}
 
-	float* oversample_fir = oim__alloc_float_array(1<<16);
-	int oversample_fir_sz = 0;
-	if (oversample_ratio > 1) {
-		oversample_fir_sz = oversample_ratio * oversample_zero_crossings;
-		double l = 1.0;
-		for(int i = 0; i < oversample_fir_sz ; i++, l+=1.0) {
-			double x = (l * OIM_PI) / (double)oversample_ratio;
-			double A = sin(x) / x; // sinc
-			double W = oim__kaiser_bessel(l / (double)oversample_fir_sz);
-			oversample_fir[i] = (A*W) / (double)oversample_ratio;
-			#if DEBUG
-			printf("#%d\t%.6f\n", i, fir[i]);
-			#endif
+/* zeroed, 64-byte aligned; from the heap without an arena */
+static void* oim__arena_alloc(struct oim__arena* a, size_t sz)
+{
+	if (a == NULL) {
+		void* p = NULL;
+		if (posix_memalign(&p, 64, sz > 0 ? sz : 64) != 0) {
+			fprintf(stderr, "posix_memalign %zu bytes: out of memory\n", sz);
+			exit(EXIT_FAILURE);
 		}
+		memset(p, 0, sz);
+		return p;
+	}
+	const size_t at = (a->used + 63) & ~(size_t)63;
+	if ((at + sz) > a->size) {
+		fprintf(stderr, "arena: %zu bytes don't fit in %zu\n", at + sz, a->size);
+		exit(EXIT_FAILURE);
 	}
+	a->used = at + sz;
+	return a->base + at;
+}
 
-	for (;;) {
-		int n_pollfds = 0;
-		unsigned int sample_rate;
-		snd_pcm_uframes_t period_size;
-		struct pollfd pollfds[OIM__MAX_POLLFD];
+static float* oim__arena_floats(struct oim__arena* a, int n)
+{
+	return oim__arena_alloc(a, sizeof(float) * n);
+}
 
-		int pcm_fdoffset = n_pollfds;
-		oim__prep_audio(&pcm, &n_pollfds, pollfds, &sample_rate, &period_size);
-		int pcm_n = n_pollfds - pcm_fdoffset;
+/* locks n bytes at p in memory, or failing that (RLIMIT_MEMLOCK, say),
+ * at least faults them in now; for writing, unless they're read only */
+static void oim__lock(const void* p, size_t n, int writable, const char* what)
+{
+	if (mlock(p, n) == 0) return;
+	fprintf(stderr, "mlock %s (%zu KiB): %s; prefaulting it instead\n", what, n >> 10, strerror(errno));
+	const long page = sysconf(_SC_PAGESIZE);
+	for (size_t i = 0; i < n; i += page) {
+		volatile uint8_t* b = (uint8_t*)p + i;
+		const uint8_t v = *b;
+		if (writable) *b = v;
+	}
+}
 
-		oim__prep_fd_at_path_for_poll(&fd_pen,     "/dev/tablet_pen",     &n_pollfds, pollfds);
-		oim__prep_fd_at_path_for_poll(&fd_touch,   "/dev/tablet_touch",   &n_pollfds, pollfds);
-		oim__prep_fd_at_path_for_poll(&fd_padbtns, "/dev/tablet_padbtns", &n_pollfds, pollfds);
-		int n_simple_pollfds = n_pollfds;
+/* gives back the address space that wasn't used, and, when locked,
+ * locks the rest */
+static void oim__arena_seal(struct oim__arena* a, int lock)
+{
+	const size_t page = oim__config.huge_pages ? OIM__HUGE_PAGE_SZ : (size_t)sysconf(_SC_PAGESIZE);
+	size_t size = (a->used + page - 1) & ~(page - 1);
+	if (size == 0) size = page;
+	munmap(a->base + size, a->size - size);
+	a->size = size;
+	if (lock) oim__lock(a->base, a->size, 1, "arena");
+}
 
-		int rawmidi_fdoffset = n_pollfds;
-		oim__prep_rawmidi_for_poll(&rawmidi, &n_pollfds, pollfds);
-		int rawmidi_n = n_pollfds - rawmidi_fdoffset;
+static void oim__arena_free(struct oim__arena* a)
+{
+	munmap(a->base, a->size);
+	a->base = NULL;
+}
 
-		if (n_pollfds == 0) {
-			sleep(1);
-			continue;
-		}
+/* vector kernels; picked once at startup from what the cpu supports.
+ * OIM_SIMD=scalar|sse2|avx2|avx512|neon overrides the choice (for
+ * testing). n is always a count of floats, and no alignment is assumed */
 
-		err = poll(pollfds, n_pollfds, 1000);
-		if (err == 0) {
-			continue;
-		} else if (err == -1) {
-			perror("poll");
-			sleep(1);
-			continue;
-		}
+/* float to integer samples: x*scale, plus dither*(u1-u2) for TPDF
+ * dither with two uniform draws, clamped to [lo:hi], and rounded to
+ * nearest. every vector lane has its own xorshift32 state in rng */
+struct oim__quantizer {
+	float scale;
+	float lo;
+	float hi;
+	float dither; // in LSBs; 1 for TPDF dither, 0 for none
+	int bytes; // per sample in the device's format: 4, 3 or 2
+	uint32_t rng[16] __attribute__((aligned(64)));
+};
 
-		for (int i = 0; i < n_simple_pollfds; i++) {
-			struct pollfd* event = &pollfds[i];
-			if (event->revents == 0) continue;
-
-			struct input_event ev;
-			if (oim__handle_input_event(&fd_pen, event, &ev)) {
-				#if DEBUG
-				printf("PEN\t0x%x 0x%x 0x%x\n", ev.type, ev.code, ev.value);
-				#endif
-				if (ev.type == EV_ABS) {
-					if (ev.code == ABS_X) {
-						/* range = [0:14720] */
-						input.pen_x = (float)ev.value / 14720.0f;
-					} else if (ev.code == ABS_Y) {
-						/* range = [0:9200] */
-						input.pen_y = (float)ev.value / 9200.0f;
-					} else if (ev.code == ABS_PRESSURE) {
-						/* range = [0:1023] */
-						input.pen_pressure = (float)ev.value / 1023.0f;
-					} else if (ev.code == ABS_DISTANCE) {
-						/* range = [0:31] */
-					}
+struct oim__kernels {
+	const char* name;
+	void (*clear)(float* y, int n);
+	void (*copy)(float* restrict y, const float* restrict x, int n);
+	void (*scale)(float* restrict y, float h, const float* restrict x, int n);
+	void (*sym_madd)(float* restrict y, float h, const float* restrict a, const float* restrict b, int n); // y += h*(a+b)
+	void (*quantize)(int32_t* restrict y, const float* restrict x, int n, struct oim__quantizer* q);
+};
 
-				}
-			}
+static void oim__clear_scalar(float* y, int n)
+{
+	for (int i = 0; i < n; i++) y[i] = 0.0f;
+}
 
-			if (oim__handle_input_event(&fd_touch, event, &ev)) {
-				#if DEBUG
-				printf("TOUCH\t0x%x 0x%x 0x%x\n", ev.type, ev.code, ev.value);
-				#endif
-			}
+static void oim__copy_scalar(float* restrict y, const float* restrict x, int n)
+{
+	for (int i = 0; i < n; i++) y[i] = x[i];
+}
 
-			if (oim__handle_input_event(&fd_padbtns, event, &ev)) {
-				#if DEBUG
-				printf("PADBTNS\t0x%x 0x%x 0x%x\n", ev.type, ev.code, ev.value);
-				#endif
-			}
+static void oim__scale_scalar(float* restrict y, float h, const float* restrict x, int n)
+{
+	for (int i = 0; i < n; i++) y[i] = h * x[i];
+}
+
+static void oim__sym_madd_scalar(float* restrict y, float h, const float* restrict a, const float* restrict b, int n)
+{
+	for (int i = 0; i < n; i++) y[i] += h * (a[i] + b[i]);
+}
+
+static inline uint32_t oim__xorshift32(uint32_t x)
+{
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return x;
+}
+
+/* [0:1) from the top 23 bits */
+static inline float oim__unit_float(uint32_t x)
+{
+	uint32_t u = (x >> 9) | 0x3f800000;
+	float f;
+	memcpy(&f, &u, sizeof f);
+	return f - 1.0f;
+}
+
+/* one sample, with lane 0; what every kernel does for its tail */
+static inline int32_t oim__quantize1(float x, struct oim__quantizer* q)
+{
+	uint32_t r0 = oim__xorshift32(q->rng[0]);
+	uint32_t r1 = oim__xorshift32(r0);
+	q->rng[0] = r1;
+	float v = x * q->scale + q->dither * (oim__unit_float(r0) - oim__unit_float(r1));
+	v = v < q->lo ? q->lo : v > q->hi ? q->hi : v;
+	return (int32_t)lrintf(v);
+}
+
+static void oim__quantize_scalar(int32_t* restrict y, const float* restrict x, int n, struct oim__quantizer* q)
+{
+	for (int i = 0; i < n; i++) y[i] = oim__quantize1(x[i], q);
+}
+
+static const struct oim__kernels oim__kernels_scalar = {
+	"scalar",
+	oim__clear_scalar,
+	oim__copy_scalar,
+	oim__scale_scalar,
+	oim__sym_madd_scalar,
+	oim__quantize_scalar,
+};
+
+/* remainder after the last full vector */
+#define OIM__TAIL(expr) for (; i < n; i++) { expr; }
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+__attribute__((target("sse2")))
+static void oim__clear_sse2(float* y, int n)
+{
+	int i = 0;
+	for (; i <= n-4; i += 4) _mm_storeu_ps(&y[i], _mm_setzero_ps());
+	OIM__TAIL(y[i] = 0.0f)
+}
+
+__attribute__((target("sse2")))
+static void oim__copy_sse2(float* restrict y, const float* restrict x, int n)
+{
+	int i = 0;
+	for (; i <= n-4; i += 4) _mm_storeu_ps(&y[i], _mm_loadu_ps(&x[i]));
+	OIM__TAIL(y[i] = x[i])
+}
+
+__attribute__((target("sse2")))
+static void oim__scale_sse2(float* restrict y, float h, const float* restrict x, int n)
+{
+	const __m128 vh = _mm_set1_ps(h);
+	int i = 0;
+	for (; i <= n-4; i += 4) _mm_storeu_ps(&y[i], _mm_mul_ps(vh, _mm_loadu_ps(&x[i])));
+	OIM__TAIL(y[i] = h * x[i])
+}
+
+__attribute__((target("sse2")))
+static void oim__sym_madd_sse2(float* restrict y, float h, const float* restrict a, const float* restrict b, int n)
+{
+	const __m128 vh = _mm_set1_ps(h);
+	int i = 0;
+	for (; i <= n-4; i += 4) {
+		__m128 s = _mm_add_ps(_mm_loadu_ps(&a[i]), _mm_loadu_ps(&b[i]));
+		_mm_storeu_ps(&y[i], _mm_add_ps(_mm_loadu_ps(&y[i]), _mm_mul_ps(vh, s)));
+	}
+	OIM__TAIL(y[i] += h * (a[i] + b[i]))
+}
+
+__attribute__((target("sse2")))
+static inline __m128i oim__xorshift32_sse2(__m128i x)
+{
+	x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+	x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+	return _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+}
+
+__attribute__((target("sse2")))
+static inline __m128 oim__unit_float_sse2(__m128i x)
+{
+	__m128i u = _mm_or_si128(_mm_srli_epi32(x, 9), _mm_set1_epi32(0x3f800000));
+	return _mm_sub_ps(_mm_castsi128_ps(u), _mm_set1_ps(1.0f));
+}
+
+__attribute__((target("sse2")))
+static void oim__quantize_sse2(int32_t* restrict y, const float* restrict x, int n, struct oim__quantizer* q)
+{
+	const __m128 vs = _mm_set1_ps(q->scale), vlo = _mm_set1_ps(q->lo), vhi = _mm_set1_ps(q->hi), vd = _mm_set1_ps(q->dither);
+	__m128i r = _mm_load_si128((__m128i*)q->rng);
+	int i = 0;
+	for (; i <= n-4; i += 4) {
+		__m128i r0 = oim__xorshift32_sse2(r);
+		r = oim__xorshift32_sse2(r0);
+		__m128 d = _mm_mul_ps(vd, _mm_sub_ps(oim__unit_float_sse2(r0), oim__unit_float_sse2(r)));
+		__m128 v = _mm_add_ps(_mm_mul_ps(vs, _mm_loadu_ps(&x[i])), d);
+		v = _mm_min_ps(_mm_max_ps(v, vlo), vhi);
+		_mm_storeu_si128((__m128i*)&y[i], _mm_cvtps_epi32(v));
+	}
+	_mm_store_si128((__m128i*)q->rng, r);
+	OIM__TAIL(y[i] = oim__quantize1(x[i], q))
+}
+
+static const struct oim__kernels oim__kernels_sse2 = {
+	"sse2",
+	oim__clear_sse2,
+	oim__copy_sse2,
+	oim__scale_sse2,
+	oim__sym_madd_sse2,
+	oim__quantize_sse2,
+};
+
+__attribute__((target("avx2,fma")))
+static void oim__clear_avx2(float* y, int n)
+{
+	int i = 0;
+	for (; i <= n-8; i += 8) _mm256_storeu_ps(&y[i], _mm256_setzero_ps());
+	OIM__TAIL(y[i] = 0.0f)
+}
+
+__attribute__((target("avx2,fma")))
+static void oim__copy_avx2(float* restrict y, const float* restrict x, int n)
+{
+	int i = 0;
+	for (; i <= n-8; i += 8) _mm256_storeu_ps(&y[i], _mm256_loadu_ps(&x[i]));
+	OIM__TAIL(y[i] = x[i])
+}
+
+__attribute__((target("avx2,fma")))
+static void oim__scale_avx2(float* restrict y, float h, const float* restrict x, int n)
+{
+	const __m256 vh = _mm256_set1_ps(h);
+	int i = 0;
+	for (; i <= n-8; i += 8) _mm256_storeu_ps(&y[i], _mm256_mul_ps(vh, _mm256_loadu_ps(&x[i])));
+	OIM__TAIL(y[i] = h * x[i])
+}
+
+__attribute__((target("avx2,fma")))
+static void oim__sym_madd_avx2(float* restrict y, float h, const float* restrict a, const float* restrict b, int n)
+{
+	const __m256 vh = _mm256_set1_ps(h);
+	int i = 0;
+	for (; i <= n-8; i += 8) {
+		__m256 s = _mm256_add_ps(_mm256_loadu_ps(&a[i]), _mm256_loadu_ps(&b[i]));
+		_mm256_storeu_ps(&y[i], _mm256_fmadd_ps(vh, s, _mm256_loadu_ps(&y[i])));
+	}
+	OIM__TAIL(y[i] += h * (a[i] + b[i]))
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256i oim__xorshift32_avx2(__m256i x)
+{
+	x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+	x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+	return _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256 oim__unit_float_avx2(__m256i x)
+{
+	__m256i u = _mm256_or_si256(_mm256_srli_epi32(x, 9), _mm256_set1_epi32(0x3f800000));
+	return _mm256_sub_ps(_mm256_castsi256_ps(u), _mm256_set1_ps(1.0f));
+}
+
+__attribute__((target("avx2,fma")))
+static void oim__quantize_avx2(int32_t* restrict y, const float* restrict x, int n, struct oim__quantizer* q)
+{
+	const __m256 vs = _mm256_set1_ps(q->scale), vlo = _mm256_set1_ps(q->lo), vhi = _mm256_set1_ps(q->hi), vd = _mm256_set1_ps(q->dither);
+	__m256i r = _mm256_load_si256((__m256i*)q->rng);
+	int i = 0;
+	for (; i <= n-8; i += 8) {
+		__m256i r0 = oim__xorshift32_avx2(r);
+		r = oim__xorshift32_avx2(r0);
+		__m256 d = _mm256_sub_ps(oim__unit_float_avx2(r0), oim__unit_float_avx2(r));
+		__m256 v = _mm256_fmadd_ps(vs, _mm256_loadu_ps(&x[i]), _mm256_mul_ps(vd, d));
+		v = _mm256_min_ps(_mm256_max_ps(v, vlo), vhi);
+		_mm256_storeu_si256((__m256i*)&y[i], _mm256_cvtps_epi32(v));
+	}
+	_mm256_store_si256((__m256i*)q->rng, r);
+	OIM__TAIL(y[i] = oim__quantize1(x[i], q))
+}
+
+static const struct oim__kernels oim__kernels_avx2 = {
+	"avx2",
+	oim__clear_avx2,
+	oim__copy_avx2,
+	oim__scale_avx2,
+	oim__sym_madd_avx2,
+	oim__quantize_avx2,
+};
+
+__attribute__((target("avx512f")))
+static void oim__clear_avx512(float* y, int n)
+{
+	int i = 0;
+	for (; i <= n-16; i += 16) _mm512_storeu_ps(&y[i], _mm512_setzero_ps());
+	if (i < n) _mm512_mask_storeu_ps(&y[i], (__mmask16)((1u << (n-i)) - 1), _mm512_setzero_ps());
+}
+
+__attribute__((target("avx512f")))
+static void oim__copy_avx512(float* restrict y, const float* restrict x, int n)
+{
+	int i = 0;
+	for (; i <= n-16; i += 16) _mm512_storeu_ps(&y[i], _mm512_loadu_ps(&x[i]));
+	if (i < n) {
+		__mmask16 m = (__mmask16)((1u << (n-i)) - 1);
+		_mm512_mask_storeu_ps(&y[i], m, _mm512_maskz_loadu_ps(m, &x[i]));
+	}
+}
+
+__attribute__((target("avx512f")))
+static void oim__scale_avx512(float* restrict y, float h, const float* restrict x, int n)
+{
+	const __m512 vh = _mm512_set1_ps(h);
+	int i = 0;
+	for (; i <= n-16; i += 16) _mm512_storeu_ps(&y[i], _mm512_mul_ps(vh, _mm512_loadu_ps(&x[i])));
+	if (i < n) {
+		__mmask16 m = (__mmask16)((1u << (n-i)) - 1);
+		_mm512_mask_storeu_ps(&y[i], m, _mm512_mul_ps(vh, _mm512_maskz_loadu_ps(m, &x[i])));
+	}
+}
+
+__attribute__((target("avx512f")))
+static void oim__sym_madd_avx512(float* restrict y, float h, const float* restrict a, const float* restrict b, int n)
+{
+	const __m512 vh = _mm512_set1_ps(h);
+	int i = 0;
+	for (; i <= n-16; i += 16) {
+		__m512 s = _mm512_add_ps(_mm512_loadu_ps(&a[i]), _mm512_loadu_ps(&b[i]));
+		_mm512_storeu_ps(&y[i], _mm512_fmadd_ps(vh, s, _mm512_loadu_ps(&y[i])));
+	}
+	if (i < n) {
+		__mmask16 m = (__mmask16)((1u << (n-i)) - 1);
+		__m512 s = _mm512_add_ps(_mm512_maskz_loadu_ps(m, &a[i]), _mm512_maskz_loadu_ps(m, &b[i]));
+		_mm512_mask_storeu_ps(&y[i], m, _mm512_fmadd_ps(vh, s, _mm512_maskz_loadu_ps(m, &y[i])));
+	}
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i oim__xorshift32_avx512(__m512i x)
+{
+	x = _mm512_xor_si512(x, _mm512_slli_epi32(x, 13));
+	x = _mm512_xor_si512(x, _mm512_srli_epi32(x, 17));
+	return _mm512_xor_si512(x, _mm512_slli_epi32(x, 5));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512 oim__unit_float_avx512(__m512i x)
+{
+	__m512i u = _mm512_or_si512(_mm512_srli_epi32(x, 9), _mm512_set1_epi32(0x3f800000));
+	return _mm512_sub_ps(_mm512_castsi512_ps(u), _mm512_set1_ps(1.0f));
+}
+
+__attribute__((target("avx512f")))
+static void oim__quantize_avx512(int32_t* restrict y, const float* restrict x, int n, struct oim__quantizer* q)
+{
+	const __m512 vs = _mm512_set1_ps(q->scale), vlo = _mm512_set1_ps(q->lo), vhi = _mm512_set1_ps(q->hi), vd = _mm512_set1_ps(q->dither);
+	__m512i r = _mm512_load_si512(q->rng);
+	int i = 0;
+	while (i < n) {
+		__mmask16 m = (n - i) >= 16 ? (__mmask16)0xffff : (__mmask16)((1u << (n-i)) - 1);
+		__m512i r0 = oim__xorshift32_avx512(r);
+		r = oim__xorshift32_avx512(r0);
+		__m512 d = _mm512_sub_ps(oim__unit_float_avx512(r0), oim__unit_float_avx512(r));
+		__m512 v = _mm512_fmadd_ps(vs, _mm512_maskz_loadu_ps(m, &x[i]), _mm512_mul_ps(vd, d));
+		v = _mm512_min_ps(_mm512_max_ps(v, vlo), vhi);
+		_mm512_mask_storeu_epi32(&y[i], m, _mm512_cvtps_epi32(v));
+		i += 16;
+	}
+	_mm512_store_si512(q->rng, r);
+}
+
+static const struct oim__kernels oim__kernels_avx512 = {
+	"avx512",
+	oim__clear_avx512,
+	oim__copy_avx512,
+	oim__scale_avx512,
+	oim__sym_madd_avx512,
+	oim__quantize_avx512,
+};
+#endif
+
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+
+static void oim__clear_neon(float* y, int n)
+{
+	int i = 0;
+	for (; i <= n-4; i += 4) vst1q_f32(&y[i], vdupq_n_f32(0.0f));
+	OIM__TAIL(y[i] = 0.0f)
+}
+
+static void oim__copy_neon(float* restrict y, const float* restrict x, int n)
+{
+	int i = 0;
+	for (; i <= n-4; i += 4) vst1q_f32(&y[i], vld1q_f32(&x[i]));
+	OIM__TAIL(y[i] = x[i])
+}
+
+static void oim__scale_neon(float* restrict y, float h, const float* restrict x, int n)
+{
+	int i = 0;
+	for (; i <= n-4; i += 4) vst1q_f32(&y[i], vmulq_n_f32(vld1q_f32(&x[i]), h));
+	OIM__TAIL(y[i] = h * x[i])
+}
+
+static void oim__sym_madd_neon(float* restrict y, float h, const float* restrict a, const float* restrict b, int n)
+{
+	int i = 0;
+	for (; i <= n-4; i += 4) {
+		float32x4_t s = vaddq_f32(vld1q_f32(&a[i]), vld1q_f32(&b[i]));
+		vst1q_f32(&y[i], vmlaq_n_f32(vld1q_f32(&y[i]), s, h));
+	}
+	OIM__TAIL(y[i] += h * (a[i] + b[i]))
+}
+
+static inline uint32x4_t oim__xorshift32_neon(uint32x4_t x)
+{
+	x = veorq_u32(x, vshlq_n_u32(x, 13));
+	x = veorq_u32(x, vshrq_n_u32(x, 17));
+	return veorq_u32(x, vshlq_n_u32(x, 5));
+}
+
+static inline float32x4_t oim__unit_float_neon(uint32x4_t x)
+{
+	uint32x4_t u = vorrq_u32(vshrq_n_u32(x, 9), vdupq_n_u32(0x3f800000));
+	return vsubq_f32(vreinterpretq_f32_u32(u), vdupq_n_f32(1.0f));
+}
+
+static void oim__quantize_neon(int32_t* restrict y, const float* restrict x, int n, struct oim__quantizer* q)
+{
+	const float32x4_t vlo = vdupq_n_f32(q->lo), vhi = vdupq_n_f32(q->hi);
+	uint32x4_t r = vld1q_u32(q->rng);
+	int i = 0;
+	for (; i <= n-4; i += 4) {
+		uint32x4_t r0 = oim__xorshift32_neon(r);
+		r = oim__xorshift32_neon(r0);
+		float32x4_t d = vsubq_f32(oim__unit_float_neon(r0), oim__unit_float_neon(r));
+		float32x4_t v = vmlaq_n_f32(vmulq_n_f32(d, q->dither), vld1q_f32(&x[i]), q->scale);
+		v = vminq_f32(vmaxq_f32(v, vlo), vhi);
+		#if defined(__aarch64__)
+		vst1q_s32(&y[i], vcvtnq_s32_f32(v));
+		#else
+		const float32x4_t half = vbslq_f32(vcltq_f32(v, vdupq_n_f32(0.0f)), vdupq_n_f32(-0.5f), vdupq_n_f32(0.5f));
+		vst1q_s32(&y[i], vcvtq_s32_f32(vaddq_f32(v, half)));
+		#endif
+	}
+	vst1q_u32(q->rng, r);
+	OIM__TAIL(y[i] = oim__quantize1(x[i], q))
+}
+
+static const struct oim__kernels oim__kernels_neon = {
+	"neon",
+	oim__clear_neon,
+	oim__copy_neon,
+	oim__scale_neon,
+	oim__sym_madd_neon,
+	oim__quantize_neon,
+};
+#endif
+
+static const struct oim__kernels* oim__kernels_available[] = {
+	#if defined(__x86_64__) || defined(__i386__)
+	&oim__kernels_avx512,
+	&oim__kernels_avx2,
+	&oim__kernels_sse2,
+	#endif
+	#if defined(__ARM_NEON) || defined(__aarch64__)
+	&oim__kernels_neon,
+	#endif
+	&oim__kernels_scalar,
+	NULL
+};
+
+static int oim__kernels_supported(const struct oim__kernels* k)
+{
+	#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (k == &oim__kernels_avx512) return __builtin_cpu_supports("avx512f");
+	if (k == &oim__kernels_avx2) return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	if (k == &oim__kernels_sse2) return __builtin_cpu_supports("sse2");
+	#endif
+	return 1;
+}
+
+static const struct oim__kernels* oim__k;
+
+static const struct oim__kernels* oim__kernels_get()
+{
+	if (oim__k != NULL) return oim__k;
+
+	const char* s = getenv("OIM_SIMD");
+	for (const struct oim__kernels** k = oim__kernels_available; *k != NULL; k++) {
+		if (s != NULL && strcmp(s, (*k)->name) != 0) continue;
+		if (!oim__kernels_supported(*k)) {
+			if (s != NULL) fprintf(stderr, "OIM_SIMD=%s: not supported by this cpu\n", s);
+			continue;
 		}
+		oim__k = *k;
+		break;
+	}
+	if (oim__k == NULL) {
+		if (s != NULL) fprintf(stderr, "OIM_SIMD=%s: unknown or unsupported; using scalar\n", s);
+		oim__k = &oim__kernels_scalar;
+	}
+	return oim__k;
+}
 
-		if (rawmidi != NULL) {
-			unsigned short revents;
-			err = snd_rawmidi_poll_descriptors_revents(rawmidi, &pollfds[rawmidi_fdoffset], rawmidi_n, &revents);
-			if (err < 0) {
-				fprintf(stderr, "midi revents error: %s\n", snd_strerror(err));
-				snd_rawmidi_close(rawmidi);
-				rawmidi = NULL;
-			} else if (revents & (POLLERR | POLLHUP)) {
-				fprintf(stderr, "midi HUP\n");
-				snd_rawmidi_close(rawmidi);
-				rawmidi = NULL;
-			} else if (revents & POLLIN) {
-				uint8_t buf[256];
-				int n_read = snd_rawmidi_read(rawmidi, buf, sizeof buf);
-				if (err == -EAGAIN) {
-					// ignore
-				} else if (n_read < 0) {
-					fprintf(stderr, "midi read error: %s\n", snd_strerror(n_read));
-					snd_rawmidi_close(rawmidi);
-					rawmidi = NULL;
-				} else {
-					#if DEBUG
-					printf("MIDI");
-					for (int i = 0; i < n_read; i++) printf(" %02X", buf[i]);
-					printf("\n");
-					#endif
-
-					for (int i = 0; i < n_read; i++) {
-						uint8_t word = buf[i];
-						if ((word & 0x80) == 0) {
-							/* MIDI is synced so
-							 * that all status
-							 * bytes have the most
-							 * significant bit set,
-							 * and all data has it
-							 * cleared */
-							continue;
-						}
-
-						uint8_t cmd = word & 0xf0;
-
-
-						int remain = (n_read - i) - 1;
-
-						if ((cmd == 0x90 || cmd == 0x80) && remain >= 2) {
-							uint8_t ch = word & 0x0f;
-							if (ch != 0) {
-								/* ignore channel!=0
-								 * messages */
-								continue;
-							}
-							uint8_t d0 = buf[++i];
-							uint8_t d1 = buf[++i];
-
-							struct oim_note_event ev;
-							ev.note = d0;
-							if (cmd == 0x90) {
-								/* note on */
-								ev.velocity = (float)d1 / 127.0f;
-							} else if (cmd == 0x80) {
-								/* note off */
-								ev.velocity = 0;
-							}
-
-							input.note_events[input.n_note_events++] = ev;
-						} else {
-							continue;
-						}
-					}
+#define OIM__QUANTIZE_CHUNK (256)
 
-				}
+/* bits is 16, 24 or 32; full scale is [-1:1) */
+static void oim__quantizer_init(struct oim__quantizer* q, int bits, int dither)
+{
+	memset(q, 0, sizeof *q);
+	q->scale = ldexpf(1.0f, bits - 1);
+	q->lo = -q->scale;
+	/* 2^31-1 isn't a float; the largest one below it is 2^31-128 */
+	q->hi = bits < 32 ? q->scale - 1.0f : 2147483520.0f;
+	q->dither = dither ? 1.0f : 0.0f;
+	q->bytes = bits / 8;
+	for (int i = 0; i < 16; i++) q->rng[i] = 0x9e3779b9u * (uint32_t)(i + 1);
+}
+
+/* n samples from x into dst, packed in the device's format. 32-bit
+ * samples are quantized straight into dst, narrower ones a chunk at a
+ * time, from a buffer that stays in L1 */
+static void oim__quantize(struct oim__quantizer* q, void* dst, const float* x, int n)
+{
+	if (q->bytes == 4) {
+		oim__k->quantize(dst, x, n, q);
+		return;
+	}
+	int32_t tmp[OIM__QUANTIZE_CHUNK];
+	for (int i = 0; i < n; i += OIM__QUANTIZE_CHUNK) {
+		const int m = (n - i) < OIM__QUANTIZE_CHUNK ? (n - i) : OIM__QUANTIZE_CHUNK;
+		oim__k->quantize(tmp, &x[i], m, q);
+		if (q->bytes == 2) {
+			int16_t* d = (int16_t*)dst + i;
+			for (int j = 0; j < m; j++) d[j] = (int16_t)tmp[j];
+		} else {
+			uint8_t* d = (uint8_t*)dst + i * 3;
+			for (int j = 0; j < m; j++) {
+				d[j*3 + 0] = (uint8_t)tmp[j];
+				d[j*3 + 1] = (uint8_t)(tmp[j] >> 8);
+				d[j*3 + 2] = (uint8_t)(tmp[j] >> 16);
 			}
 		}
+	}
+}
 
-		if (pcm != NULL)  {
-			unsigned short revents;
-			err = snd_pcm_poll_descriptors_revents(pcm, &pollfds[pcm_fdoffset], pcm_n, &revents);
-			if (err < 0) {
-				fprintf(stderr, "pcm revents error: %s\n", snd_strerror(err));
-				snd_pcm_close(pcm);
-				pcm = NULL;
-			} else if (revents & (POLLERR | POLLHUP)) {
-				fprintf(stderr, "pcm HUP\n");
-				snd_pcm_close(pcm);
-				pcm = NULL;
-			} else if (revents & POLLOUT) {
-				/*
-				printf("x=%.3f\ty=%.3f\tp=%.3f\n", input.pen_x, input.pen_y, input.pen_pressure);
-				if (input.n_note_events > 0) {
-					printf("%d note events\n", input.n_note_events);
-				}
-				*/
-
-				if (oversample_ratio > 1) {
-					/* XXX I'm not convinced oversampling
-					 * works at all... try listen to the
-					 * weird aliasing stuff happening at
-					 * higher oscillator frequencies */
-					memcpy(
-						tmp_buffer,
-						&tmp_buffer[OIM_N_CHANNELS * period_size * oversample_ratio],
-						OIM_N_CHANNELS * oversample_fir_sz * sizeof *tmp_buffer);
-
-					process_fn(
-						(int)sample_rate * oversample_ratio,
-						(int)period_size * oversample_ratio,
-						&tmp_buffer[OIM_N_CHANNELS * oversample_fir_sz],
-						process_fn_usr,
-						&input);
-
-					int ti, ti_begin = 0;
-					for (int i = 0; i < (period_size * OIM_N_CHANNELS); i += OIM_N_CHANNELS) {
-						for (int ch = 0; ch < OIM_N_CHANNELS; ch++) {
-							buffer[i + ch] = 0;
-						}
-
-						ti = ti_begin;
-
-						for (int j = (oversample_fir_sz - 1); j >= 0; j--) {
-							float f = oversample_fir[j];
-							for (int ch = 0; ch < OIM_N_CHANNELS; ch++) {
-								buffer[i + ch] += f * tmp_buffer[ti++];
-							}
-						}
-
-						for (int ch = 0; ch < OIM_N_CHANNELS; ch++) {
-							buffer[i + ch] += tmp_buffer[ti++];
-						}
-
-						for (int j = 0; j < oversample_fir_sz; j++) {
-							float f = oversample_fir[j];
-							for (int ch = 0; ch < OIM_N_CHANNELS; ch++) {
-								buffer[i + ch] += f * tmp_buffer[ti++];
-							}
-						}
-
-						ti_begin += oversample_ratio * OIM_N_CHANNELS;
-
-						#if DEBUG
-						printf("%.4d\t%.6f\t", i, buffer[i]);
-
-						int W = 50;
-						int X = (int)(((buffer[i] + 1.0) / 2.0f) * (float)W);
-						for (int x = 0; x < W; x++) {
-							putchar(x == X ? '*' : x == W/2 ? '|' : ' ');
-						}
-						putchar('\n');
-						#endif
-					}
-				} else {
-					process_fn(sample_rate, period_size, buffer, process_fn_usr, &input);
-				}
-				input.n_note_events = 0;
-				snd_pcm_sframes_t n_frames = snd_pcm_writei(pcm, buffer, period_size);
-				if (n_frames < 0) {
-					fprintf(stderr, "snd_pcm_writei: %s\n", snd_strerror(n_frames));
-					if ((err = snd_pcm_prepare(pcm)) < 0) {
-						fprintf(stderr, "snd_pcm_prepare: %s\n", snd_strerror(n_frames));
-						pcm = NULL;
+/* decimator; converts a stream of interleaved frames at
+ * ratio*sample_rate down to sample_rate. power-of-two ratios are handled
+ * as a cascade of half-band stages (only every second tap is non-zero,
+ * and only every second output is computed), other ratios get a
+ * polyphase FIR stage for the odd factor first.
+ *
+ * each stage splits its input into one ring per polyphase branch
+ * (input frame i goes to branch i%factor), so for any given tap the
+ * inputs seen by consecutive outputs are consecutive frames in one
+ * ring. computing a chunk of outputs is then one contiguous
+ * y+=h*(a+b) per symmetric tap pair, regardless of channel count. the
+ * rings are mirrored (every frame is written twice, one ring length
+ * apart) so those runs never wrap and nothing is ever moved */
+
+enum oim_decimator_kind {
+	OIM_DECIMATOR_MULTISTAGE = 0,
+	OIM_DECIMATOR_SINGLE,
+	OIM_DECIMATOR_N_KINDS
+};
+
+static const char* oim__decimator_kind_names[] = { "multistage", "single" };
+
+#define OIM__DECIMATOR_MAX_STAGES (16)
+#define OIM__DECIMATOR_CHUNK (256) // in output frames
+
+struct oim__decimator_stage {
+	int factor;
+	int step; // distance between non-zero taps; 2 for half-band
+	int n_coefs;
+	float* coefs; // one side of a symmetric filter; coefs[k] is at distance step*k+1 from the center
+	float center;
+	int n_taps; // window length in frames
+	int n_slots; // frames per branch ring
+	float* history; // factor rings of 2*n_slots frames each
+	int phase; // branch of the next input frame
+	int slot; // ring slot of the next input frame
+};
+
+struct oim_decimator {
+	int ratio;
+	int n_channels;
+	struct oim__arena* arena; // where the stages' arrays are, or NULL for the heap
+	int n_stages;
+	struct oim__decimator_stage stages[OIM__DECIMATOR_MAX_STAGES];
+};
+
+static void oim__decimator_stage_init(struct oim__decimator_stage* st, struct oim__arena* arena, int factor, int step, int n_coefs, int n_channels)
+{
+	memset(st, 0, sizeof *st);
+	st->factor = factor;
+	st->step = step;
+	st->n_coefs = n_coefs;
+	st->coefs = oim__arena_floats(arena, n_coefs);
+	st->n_taps = 2 * (step * (n_coefs - 1) + 1) + 1;
+	st->n_slots = st->n_taps / factor + OIM__DECIMATOR_CHUNK + 4;
+	st->history = oim__arena_floats(arena, factor * 2 * st->n_slots * n_channels);
+
+	/* windowed sinc with cutoff at the output nyquist */
+	double sum = 1.0;
+	double edge = (double)(step * n_coefs);
+	double coefs[n_coefs];
+	for (int k = 0; k < n_coefs; k++) {
+		double l = (double)(step * k + 1);
+		double x = (l * OIM_PI) / (double)factor;
+		double A = sin(x) / x;
+		double W = oim__kaiser_bessel(l / edge);
+		coefs[k] = A*W;
+		sum += 2.0 * coefs[k];
+	}
+	st->center = 1.0 / sum;
+	for (int k = 0; k < n_coefs; k++) st->coefs[k] = coefs[k] / sum;
+}
+
+static void oim__decimator_init(struct oim_decimator* dec, struct oim__arena* arena, enum oim_decimator_kind kind, int ratio, int zero_crossings, int n_channels)
+{
+	assert(ratio >= 1);
+	assert(zero_crossings >= 1);
+	memset(dec, 0, sizeof *dec);
+	dec->ratio = ratio;
+	dec->n_channels = n_channels;
+	dec->arena = arena;
+	oim__kernels_get();
+	if (ratio == 1) return;
+
+	if (kind == OIM_DECIMATOR_SINGLE) {
+		oim__decimator_stage_init(&dec->stages[dec->n_stages++], arena, ratio, 1, ratio * zero_crossings, n_channels);
+		return;
+	}
+
+	int odd = ratio;
+	int n_halfbands = 0;
+	while ((odd & 1) == 0) {
+		odd >>= 1;
+		n_halfbands++;
+	}
+	assert(n_halfbands < OIM__DECIMATOR_MAX_STAGES);
+
+	if (odd > 1) {
+		oim__decimator_stage_init(&dec->stages[dec->n_stages++], arena, odd, 1, odd * zero_crossings, n_channels);
+	}
+
+	/* the earlier a half-band stage runs, the wider its transition band
+	 * is allowed to be (relative to its own rate), so it gets away with
+	 * fewer zero crossings. the last stage guards the actual passband
+	 * edge and gets twice the requested amount */
+	for (int i = n_halfbands - 1; i >= 0; i--) {
+		int zc = i == 0 ? zero_crossings * 2 : zero_crossings >> (i - 1);
+		if (zc < 1) zc = 1;
+		oim__decimator_stage_init(&dec->stages[dec->n_stages++], arena, 2, 2, zc, n_channels);
+	}
+}
+
+void oim_decimator_init(struct oim_decimator* dec, enum oim_decimator_kind kind, int ratio, int zero_crossings, int n_channels)
+{
+	oim__decimator_init(dec, NULL, kind, ratio, zero_crossings, n_channels);
+}
+
+void oim_decimator_free(struct oim_decimator* dec)
+{
+	for (int i = 0; dec->arena == NULL && i < dec->n_stages; i++) {
+		free(dec->stages[i].coefs);
+		free(dec->stages[i].history);
+	}
+	dec->n_stages = 0;
+}
+
+/* forgets all history, e.g. after the stream was interrupted */
+void oim_decimator_reset(struct oim_decimator* dec)
+{
+	for (int i = 0; i < dec->n_stages; i++) {
+		struct oim__decimator_stage* st = &dec->stages[i];
+		oim__k->clear(st->history, st->factor * 2 * st->n_slots * dec->n_channels);
+		st->phase = 0;
+		st->slot = 0;
+	}
+}
+
+/* returns the start of the run of inputs seen by window position t for
+ * outputs starting at slot m (the slot of the input completing the
+ * first output's window) */
+static inline const float* oim__decimator_stage_run(struct oim__decimator_stage* st, int n_channels, int m, int t)
+{
+	const int r = t + st->factor - st->n_taps;
+	int q = r / st->factor;
+	int branch = r % st->factor;
+	if (branch < 0) {
+		branch += st->factor;
+		q--;
+	}
+	int s = (m + q) % st->n_slots;
+	if (s < 0) s += st->n_slots;
+	return &st->history[(branch * 2 * st->n_slots + s) * n_channels];
+}
+
+/* with a quantizer, every chunk of output is also quantized into qdst
+ * while it's still in L1 */
+static inline __attribute__((always_inline)) int oim__decimator_stage_process_n(struct oim__decimator_stage* st, const int n_channels, const float* in, int n_in_frames, float* out, struct oim__quantizer* q, void* qdst)
+{
+	const struct oim__kernels* K = oim__k;
+	const int factor = st->factor;
+	const int n_slots = st->n_slots;
+	const int c = st->n_taps / 2;
+	int n_out_frames = 0;
+	int i = 0;
+	while (i < n_in_frames) {
+		int n = n_in_frames - i;
+		if (n > (OIM__DECIMATOR_CHUNK * factor)) n = OIM__DECIMATOR_CHUNK * factor;
+
+		const int j0 = factor - 1 - st->phase;
+		const int m0 = st->slot;
+
+		/* deal the chunk out to the branch rings, one strided run
+		 * per branch */
+		for (int p = 0; p < factor; p++) {
+			int j = p - st->phase;
+			int s = st->slot;
+			if (j < 0) {
+				j += factor;
+				s++;
+			}
+			if (j >= n) continue;
+			int count = (n - 1 - j) / factor + 1;
+			float* ring = &st->history[p * 2 * n_slots * n_channels];
+			const float* src = &in[(i + j) * n_channels];
+			while (count > 0) {
+				if (s >= n_slots) s -= n_slots;
+				int run = count;
+				if (run > (n_slots - s)) run = n_slots - s;
+				float* d0 = &ring[s * n_channels];
+				float* d1 = &ring[(s + n_slots) * n_channels];
+				for (int q = 0; q < run; q++) {
+					for (int ch = 0; ch < n_channels; ch++) {
+						d0[q*n_channels + ch] = d1[q*n_channels + ch] = src[q*factor*n_channels + ch];
 					}
 				}
+				src += run * factor * n_channels;
+				s += run;
+				count -= run;
+			}
+		}
+		st->slot = (st->slot + (st->phase + n) / factor) % n_slots;
+		st->phase = (st->phase + n) % factor;
+
+		/* out may alias in, but the whole chunk has been consumed
+		 * now, and outputs never overtake inputs */
+		if (j0 < n) {
+			const int n_out = (n - 1 - j0) / factor + 1;
+			const int len = n_out * n_channels;
+			float* y = &out[n_out_frames * n_channels];
+			K->scale(y, st->center, oim__decimator_stage_run(st, n_channels, m0, c), len);
+			for (int k = 0; k < st->n_coefs; k++) {
+				const int d = st->step * k + 1;
+				K->sym_madd(
+					y,
+					st->coefs[k],
+					oim__decimator_stage_run(st, n_channels, m0, c - d),
+					oim__decimator_stage_run(st, n_channels, m0, c + d),
+					len);
+			}
+			if (q != NULL) oim__quantize(q, (uint8_t*)qdst + n_out_frames * n_channels * q->bytes, y, len);
+			n_out_frames += n_out;
+		}
+
+		i += n;
+	}
+	return n_out_frames;
+}
+
+static int oim__decimator_stage_process(struct oim__decimator_stage* st, int n_channels, const float* in, int n_in_frames, float* out, struct oim__quantizer* q, void* qdst)
+{
+	/* constant channel counts let the compiler unroll the frame copies */
+	switch (n_channels) {
+	case 1: return oim__decimator_stage_process_n(st, 1, in, n_in_frames, out, q, qdst);
+	case 2: return oim__decimator_stage_process_n(st, 2, in, n_in_frames, out, q, qdst);
+	case 4: return oim__decimator_stage_process_n(st, 4, in, n_in_frames, out, q, qdst);
+	case 8: return oim__decimator_stage_process_n(st, 8, in, n_in_frames, out, q, qdst);
+	default: return oim__decimator_stage_process_n(st, n_channels, in, n_in_frames, out, q, qdst);
+	}
+}
+
+/* decimates n_in_frames interleaved frames from in into out, and returns
+ * the number of output frames. in is used as scratch space between
+ * stages, so its contents are undefined afterwards */
+int oim_decimator_process(struct oim_decimator* dec, float* in, int n_in_frames, float* out)
+{
+	if (dec->n_stages == 0) {
+		oim__k->copy(out, in, n_in_frames * dec->n_channels);
+		return n_in_frames;
+	}
+	int n = n_in_frames;
+	for (int i = 0; i < dec->n_stages; i++) {
+		float* dst = i == (dec->n_stages - 1) ? out : in;
+		n = oim__decimator_stage_process(&dec->stages[i], dec->n_channels, in, n, dst, NULL, NULL);
+	}
+	return n;
+}
+
+/* the same, with the output quantized into out by the last stage, which
+ * leaves its float output in in */
+static int oim__decimator_process_quantized(struct oim_decimator* dec, float* in, int n_in_frames, void* out, struct oim__quantizer* q)
+{
+	if (dec->n_stages == 0) {
+		oim__quantize(q, out, in, n_in_frames * dec->n_channels);
+		return n_in_frames;
+	}
+	int n = n_in_frames;
+	for (int i = 0; i < dec->n_stages; i++) {
+		const int last = i == (dec->n_stages - 1);
+		n = oim__decimator_stage_process(&dec->stages[i], dec->n_channels, in, n, in, last ? q : NULL, out);
+	}
+	return n;
+}
+
+static enum oim_decimator_kind oim__decimator_kind_from_env()
+{
+	const char* s = getenv("OIM_DECIMATOR");
+	if (s == NULL) return OIM_DECIMATOR_MULTISTAGE;
+	for (int kind = 0; kind < OIM_DECIMATOR_N_KINDS; kind++) {
+		if (strcmp(s, oim__decimator_kind_names[kind]) == 0) return kind;
+	}
+	fprintf(stderr, "OIM_DECIMATOR=%s: expected \"multistage\" or \"single\"\n", s);
+	exit(EXIT_FAILURE);
+}
+
+static double oim__now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static int64_t oim__now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* mip-mapped wavetables. each wave has a table per octave; level k
+ * holds the harmonics up to OIM__WAVETABLE_HARMONICS>>k, so reading the
+ * right level for a given dt (see oim_phase_advance) never aliases.
+ * tables are built by inverse FFT from the waves' Fourier series, and
+ * cached in a file which later starts just mmap */
+
+enum oim_wave {
+	OIM_WAVE_SINE = 0,
+	OIM_WAVE_SAW,      // like oim_osc_saw
+	OIM_WAVE_SQUARE,   // like oim_osc_pulse at duty 0.5
+	OIM_WAVE_TRIANGLE, // like oim_osc_triangle
+	OIM_N_WAVES
+};
+
+#define OIM__WAVETABLE_VERSION (1)
+#define OIM__WAVETABLE_LOG2_SIZE (11)
+#define OIM__WAVETABLE_SIZE (1 << OIM__WAVETABLE_LOG2_SIZE)
+#define OIM__WAVETABLE_HARMONICS (OIM__WAVETABLE_SIZE / 2)
+#define OIM__WAVETABLE_N_LEVELS (OIM__WAVETABLE_LOG2_SIZE)
+/* one guard sample at the end repeats the first, so lookups needn't wrap */
+#define OIM__WAVETABLE_STRIDE (OIM__WAVETABLE_SIZE + 1)
+
+struct oim__wavetable_header {
+	char magic[4]; // "oimw"
+	uint32_t version;
+	uint32_t size;
+	uint32_t n_levels;
+	uint32_t n_waves;
+	uint32_t sizeof_float;
+};
+
+#define OIM__WAVETABLE_FILE_SZ (sizeof(struct oim__wavetable_header) + sizeof(float) * OIM_N_WAVES * OIM__WAVETABLE_N_LEVELS * OIM__WAVETABLE_STRIDE)
+
+static const float* oim__wavetables;
+
+/* in-place radix-2 FFT of n complex values; inverse when sign > 0, and
+ * unscaled either way */
+static void oim__fft(double* re, double* im, int n, int sign)
+{
+	for (int i = 1, j = 0; i < n; i++) {
+		int bit = n >> 1;
+		for (; j & bit; bit >>= 1) j ^= bit;
+		j ^= bit;
+		if (i < j) {
+			double t;
+			t = re[i]; re[i] = re[j]; re[j] = t;
+			t = im[i]; im[i] = im[j]; im[j] = t;
+		}
+	}
+	for (int len = 2; len <= n; len <<= 1) {
+		const double a = sign * OIM_PI2 / (double)len;
+		for (int k = 0; k < len/2; k++) {
+			const double wr = cos(a * k);
+			const double wi = sin(a * k);
+			for (int i = k; i < n; i += len) {
+				const int j = i + len/2;
+				const double xr = re[j] * wr - im[j] * wi;
+				const double xi = re[j] * wi + im[j] * wr;
+				re[j] = re[i] - xr;
+				im[j] = im[i] - xi;
+				re[i] += xr;
+				im[i] += xi;
 			}
 		}
 	}
 }
 
+/* amplitude of harmonic h as a*cos + b*sin */
+static void oim__wave_harmonic(enum oim_wave wave, int h, double* a, double* b)
+{
+	*a = *b = 0;
+	switch (wave) {
+	case OIM_WAVE_SINE:
+		if (h == 1) *b = 1;
+		break;
+	case OIM_WAVE_SAW:
+		*b = -2.0 / (OIM_PI * h);
+		break;
+	case OIM_WAVE_SQUARE:
+		if (h & 1) *b = 4.0 / (OIM_PI * h);
+		break;
+	case OIM_WAVE_TRIANGLE:
+		if (h & 1) *a = -8.0 / (OIM_PI * OIM_PI * h * h);
+		break;
+	default:
+		assert(!"unhandled wave");
+	}
+}
+
+static void oim__wavetables_build(float* tables)
+{
+	const int N = OIM__WAVETABLE_SIZE;
+	double* re = calloc(N, sizeof *re);
+	double* im = calloc(N, sizeof *im);
+	assert(re != NULL && im != NULL);
+	for (int wave = 0; wave < OIM_N_WAVES; wave++) {
+		for (int level = 0; level < OIM__WAVETABLE_N_LEVELS; level++) {
+			memset(re, 0, N * sizeof *re);
+			memset(im, 0, N * sizeof *im);
+			const int n_harmonics = OIM__WAVETABLE_HARMONICS >> level;
+			for (int h = 1; h <= n_harmonics && h < N/2; h++) {
+				double a, b;
+				oim__wave_harmonic(wave, h, &a, &b);
+				re[h] = a * 0.5;
+				im[h] = -b * 0.5;
+				re[N-h] = a * 0.5;
+				im[N-h] = b * 0.5;
+			}
+			oim__fft(re, im, N, 1);
+			float* t = &tables[(wave * OIM__WAVETABLE_N_LEVELS + level) * OIM__WAVETABLE_STRIDE];
+			for (int i = 0; i < N; i++) t[i] = re[i];
+			t[N] = t[0];
+		}
+	}
+	free(re);
+	free(im);
+}
+
+static void oim__wavetable_header_init(struct oim__wavetable_header* h)
+{
+	memset(h, 0, sizeof *h);
+	memcpy(h->magic, "oimw", 4);
+	h->version = OIM__WAVETABLE_VERSION;
+	h->size = OIM__WAVETABLE_SIZE;
+	h->n_levels = OIM__WAVETABLE_N_LEVELS;
+	h->n_waves = OIM_N_WAVES;
+	h->sizeof_float = sizeof(float);
+}
+
+/* the cache path defaults to $XDG_CACHE_HOME/oim/wavetables.bin, or
+ * ~/.cache/oim/wavetables.bin, creating the directories */
+static int oim__wavetable_cache_path(char* path, size_t sz)
+{
+	if (oim__config.wavetable_cache != NULL) {
+		snprintf(path, sz, "%s", oim__config.wavetable_cache);
+		return 1;
+	}
+	const char* xdg = getenv("XDG_CACHE_HOME");
+	const char* home = getenv("HOME");
+	if (xdg != NULL && xdg[0] != 0) {
+		snprintf(path, sz, "%s", xdg);
+	} else if (home != NULL) {
+		snprintf(path, sz, "%s/.cache", home);
+	} else {
+		return 0;
+	}
+	mkdir(path, 0755);
+	strncat(path, "/oim", sz - strlen(path) - 1);
+	mkdir(path, 0755);
+	strncat(path, "/wavetables.bin", sz - strlen(path) - 1);
+	return 1;
+}
+
+static const float* oim__wavetables_mmap(const char* path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) return NULL;
+	struct stat st;
+	void* p = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size == (off_t)OIM__WAVETABLE_FILE_SZ) {
+		p = mmap(NULL, OIM__WAVETABLE_FILE_SZ, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (p == MAP_FAILED) return NULL;
+
+	struct oim__wavetable_header want;
+	oim__wavetable_header_init(&want);
+	if (memcmp(p, &want, sizeof want) != 0) {
+		munmap(p, OIM__WAVETABLE_FILE_SZ);
+		return NULL;
+	}
+	return (const float*)((uint8_t*)p + sizeof want);
+}
+
+/* writes to a temporary file first, so that concurrent starts never see
+ * a half written cache */
+static void oim__wavetables_save(const char* path, const float* tables)
+{
+	char tmp[4096];
+	snprintf(tmp, sizeof tmp, "%s.%d", path, (int)getpid());
+	FILE* f = fopen(tmp, "wb");
+	if (f == NULL) {
+		fprintf(stderr, "%s: %s\n", tmp, strerror(errno));
+		return;
+	}
+	struct oim__wavetable_header h;
+	oim__wavetable_header_init(&h);
+	const size_t n = OIM_N_WAVES * OIM__WAVETABLE_N_LEVELS * OIM__WAVETABLE_STRIDE;
+	int ok = fwrite(&h, sizeof h, 1, f) == 1 && fwrite(tables, sizeof *tables, n, f) == n;
+	ok = (fclose(f) == 0) && ok;
+	if (!ok || rename(tmp, path) == -1) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		unlink(tmp);
+	}
+}
+
+static void oim__wavetables_load()
+{
+	if (oim__wavetables != NULL) return;
+
+	char path[4096];
+	int have_path = oim__wavetable_cache_path(path, sizeof path);
+	if (have_path && (oim__wavetables = oim__wavetables_mmap(path)) != NULL) return;
+
+	float* tables = oim__alloc_float_array(OIM_N_WAVES * OIM__WAVETABLE_N_LEVELS * OIM__WAVETABLE_STRIDE);
+	const double t0 = oim__now();
+	oim__wavetables_build(tables);
+	fprintf(stderr, "built wavetables in %.3fs\n", oim__now() - t0);
+	if (have_path) oim__wavetables_save(path, tables);
+	oim__wavetables = tables;
+}
+
+/* the level of wave to read at phase advance dt; the highest harmonic in
+ * it stays below nyquist */
+static inline const float* oim_wavetable(enum oim_wave wave, float dt)
+{
+	assert(oim__wavetables != NULL);
+	const float m = dt * (float)(2 * OIM__WAVETABLE_HARMONICS);
+	int level = 0;
+	if (m > 1.0f) {
+		level = 32 - __builtin_clz((unsigned int)ceilf(m) - 1);
+		if (level >= OIM__WAVETABLE_N_LEVELS) level = OIM__WAVETABLE_N_LEVELS - 1;
+	}
+	return &oim__wavetables[(wave * OIM__WAVETABLE_N_LEVELS + level) * OIM__WAVETABLE_STRIDE];
+}
+
+/* linearly interpolated read at phase [0:1) */
+static inline float oim_wavetable_read(const float* table, float phase)
+{
+	const float x = phase * (float)OIM__WAVETABLE_SIZE;
+	const int i = (int)x;
+	const float f = x - (float)i;
+	return table[i] + (table[i+1] - table[i]) * f;
+}
+
+/* worker pool; runs a fixed set of tasks, once per period, on the calling
+ * thread and n_workers more. every thread owns a range of the tasks and
+ * claims them one at a time from its front; once its own are gone it
+ * steals from the others' in the same way, so a slow task only holds up
+ * the thread running it. claims are a fetch_add on the owner's next
+ * index, so every task runs exactly once, and nothing waits on a lock.
+ * idle workers sleep on a futex until the next period */
+
+#define OIM__MAX_WORKERS (64)
+
+typedef void (*oim__task_fn)(void* usr, int task);
+
+struct oim__worker {
+	uint32_t next __attribute__((aligned(64))); // next task to claim
+	uint32_t begin, end;
+	int index;
+	pthread_t thread;
+	struct oim__pool* pool;
+};
+
+struct oim__pool {
+	int n_workers;
+	int n_tasks;
+	oim__task_fn task_fn;
+	void* task_usr;
+	uint32_t generation __attribute__((aligned(64))); // bumped to start a period
+	uint32_t n_done __attribute__((aligned(64)));
+	int stop;
+	struct oim__worker workers[OIM__MAX_WORKERS + 1]; // [0] is the caller
+};
+
+static void oim__futex_wait(uint32_t* p, uint32_t v)
+{
+	syscall(SYS_futex, p, FUTEX_WAIT_PRIVATE, v, NULL, NULL, 0);
+}
+
+static void oim__futex_wake(uint32_t* p)
+{
+	syscall(SYS_futex, p, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+static void oim__pool_work(struct oim__pool* pool, int self)
+{
+	const int n = pool->n_workers + 1;
+	for (int k = 0; k < n; k++) {
+		struct oim__worker* w = &pool->workers[(self + k) % n];
+		for (;;) {
+			uint32_t t = __atomic_fetch_add(&w->next, 1, __ATOMIC_ACQ_REL);
+			if (t >= w->end) break;
+			pool->task_fn(pool->task_usr, t);
+			if (__atomic_add_fetch(&pool->n_done, 1, __ATOMIC_ACQ_REL) == (uint32_t)pool->n_tasks) {
+				oim__futex_wake(&pool->n_done);
+			}
+		}
+	}
+}
+
+static void* oim__pool_thread(void* usr)
+{
+	struct oim__worker* w = usr;
+	struct oim__pool* pool = w->pool;
+	uint32_t seen = 0;
+	for (;;) {
+		uint32_t g;
+		while ((g = __atomic_load_n(&pool->generation, __ATOMIC_ACQUIRE)) == seen) {
+			oim__futex_wait(&pool->generation, seen);
+		}
+		seen = g;
+		if (pool->stop) break;
+		oim__pool_work(pool, w->index);
+	}
+	return NULL;
+}
+
+/* workers are pinned to a core each, and are SCHED_FIFO at --rt-priority
+ * if realtime */
+static void oim__pool_init(struct oim__pool* pool, int n_workers, int n_tasks, oim__task_fn task_fn, void* task_usr, int realtime)
+{
+	memset(pool, 0, sizeof *pool);
+	if (n_workers > OIM__MAX_WORKERS) n_workers = OIM__MAX_WORKERS;
+	pool->n_workers = n_workers;
+	pool->n_tasks = n_tasks;
+	pool->task_fn = task_fn;
+	pool->task_usr = task_usr;
+
+	const int n = n_workers + 1;
+	for (int i = 0; i < n; i++) {
+		struct oim__worker* w = &pool->workers[i];
+		w->index = i;
+		w->pool = pool;
+		w->begin = (uint32_t)((i * n_tasks) / n);
+		w->end = (uint32_t)(((i + 1) * n_tasks) / n);
+		w->next = w->end;
+	}
+
+	const long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int rt_failed = 0;
+	for (int i = 1; i < n; i++) {
+		struct oim__worker* w = &pool->workers[i];
+		int err = pthread_create(&w->thread, NULL, oim__pool_thread, w);
+		if (err != 0) {
+			fprintf(stderr, "pthread_create: %s\n", strerror(err));
+			exit(EXIT_FAILURE);
+		}
+		if (n_cpus > 1) {
+			cpu_set_t cpus;
+			CPU_ZERO(&cpus);
+			CPU_SET(i % n_cpus, &cpus);
+			pthread_setaffinity_np(w->thread, sizeof cpus, &cpus);
+		}
+		if (realtime) {
+			struct sched_param param;
+			memset(&param, 0, sizeof param);
+			param.sched_priority = oim__config.rt_priority;
+			if (pthread_setschedparam(w->thread, SCHED_FIFO, &param) != 0) rt_failed = 1;
+		}
+	}
+	if (n_workers > 0) {
+		fprintf(stderr, "%d workers for %d layers%s\n", n_workers, n_tasks, rt_failed ? ", without SCHED_FIFO" : "");
+	}
+}
+
+static void oim__pool_free(struct oim__pool* pool)
+{
+	pool->stop = 1;
+	__atomic_add_fetch(&pool->generation, 1, __ATOMIC_RELEASE);
+	oim__futex_wake(&pool->generation);
+	for (int i = 1; i <= pool->n_workers; i++) pthread_join(pool->workers[i].thread, NULL);
+}
+
+/* runs every task once, and returns when they're all done */
+static void oim__pool_run(struct oim__pool* pool)
+{
+	if (pool->n_workers == 0) {
+		for (int i = 0; i < pool->n_tasks; i++) pool->task_fn(pool->task_usr, i);
+		return;
+	}
+	__atomic_store_n(&pool->n_done, 0, __ATOMIC_RELAXED);
+	for (int i = 0; i <= pool->n_workers; i++) {
+		__atomic_store_n(&pool->workers[i].next, pool->workers[i].begin, __ATOMIC_RELEASE);
+	}
+	__atomic_add_fetch(&pool->generation, 1, __ATOMIC_RELEASE);
+	oim__futex_wake(&pool->generation);
+
+	oim__pool_work(pool, 0);
+
+	uint32_t d;
+	while ((d = __atomic_load_n(&pool->n_done, __ATOMIC_ACQUIRE)) != (uint32_t)pool->n_tasks) {
+		oim__futex_wait(&pool->n_done, d);
+	}
+}
+
+/* everything between the input state and a period of output frames;
+ * shared by oim_run and oim_render_offline.
+ *
+ * with only interleaved layers, the engine is interleaved throughout.
+ * with any planar layer, it's planar: interleaved layers are split into
+ * channels after rendering, every channel is decimated on its own
+ * contiguous array, and frames are only interleaved at the end */
+
+/* a layer on whatever --midi-channel is */
+#define OIM__MIDI_CHANNEL_MAIN (~0u)
+
+struct oim__layer {
+	unsigned int midi_channel;
+	oim_process_fn process_fn;
+	oim_planar_fn planar_fn;
+	int n_channels;
+	void* usr;
+	float* buffer; // interleaved; where layers after the first render, and any layer of a planar engine that isn't planar
+	float* planes[OIM_N_CHANNELS]; // where planar layers after the first render
+	struct oim_input input;
+};
+
+static struct oim__layer oim__layers[OIM_MAX_LAYERS];
+static int oim__n_layers;
+
+static void oim__layer_add(unsigned int midi_channel, oim_process_fn process_fn, oim_planar_fn planar_fn, int n_channels, void* usr)
+{
+	if (oim__n_layers == OIM_MAX_LAYERS) {
+		fprintf(stderr, "more than %d layers\n", OIM_MAX_LAYERS);
+		exit(EXIT_FAILURE);
+	}
+	if (midi_channel > 16 && midi_channel != OIM__MIDI_CHANNEL_MAIN) {
+		fprintf(stderr, "layer on MIDI channel %u; must be 1-16, or 0 for all\n", midi_channel);
+		exit(EXIT_FAILURE);
+	}
+	if (n_channels != 1 && n_channels != OIM_N_CHANNELS) {
+		fprintf(stderr, "planar layer with %d channels; must be 1 or %d\n", n_channels, OIM_N_CHANNELS);
+		exit(EXIT_FAILURE);
+	}
+	struct oim__layer* l = &oim__layers[oim__n_layers++];
+	l->midi_channel = midi_channel;
+	l->process_fn = process_fn;
+	l->planar_fn = planar_fn;
+	l->n_channels = n_channels;
+	l->usr = usr;
+}
+
+void oim_layer(unsigned int midi_channel, oim_process_fn process_fn, void* usr)
+{
+	oim__layer_add(midi_channel, process_fn, NULL, OIM_N_CHANNELS, usr);
+}
+
+void oim_layer_planar(unsigned int midi_channel, int n_channels, oim_planar_fn fn, void* usr)
+{
+	oim__layer_add(midi_channel, NULL, fn, n_channels, usr);
+}
+
+static void oim__alloc_planes(struct oim__arena* arena, float** planes, int n_planes, int plane_sz)
+{
+	float* block = oim__arena_floats(arena, plane_sz * n_planes);
+	for (int i = 0; i < n_planes; i++) planes[i] = &block[i * plane_sz];
+}
+
+struct oim__engine {
+	int oversample_ratio;
+	int max_frames; // the most output frames rendered at once
+	struct oim__arena arena; // everything below that's rendered with
+	struct oim__layer* layers;
+	int n_layers;
+	int main_layer; // the layer on --midi-channel that oim_run was given, or -1
+	struct oim__pool pool;
+	struct oim_decimator decimator;
+	float* tmp_buffer; // oversampled, before decimation, or before quantizing
+	float* out; // max_frames frames, for callers with no buffer of their own
+	struct oim__quantizer* quantizer; // renders integer samples, when set
+
+	/* planar engines; n_planes is 1 if every layer is mono. planes are
+	 * plane_sz floats, a multiple of 16, so every one stays 64-byte
+	 * aligned */
+	int planar;
+	int n_planes;
+	int plane_sz;
+	float* planes[OIM_N_CHANNELS];
+	struct oim_decimator plane_decimators[OIM_N_CHANNELS];
+
+	/* what the layers render, while they do */
+	uint32_t render_sample_rate;
+	uint32_t render_n_frames;
+	float* render_buffer;
+
+	/* when timed, time spent in process_fn and in the decimator, and
+	 * the number of renders whose process_fn output had subnormals,
+	 * accumulate here until the caller collects them */
+	int timed;
+	int64_t t_process;
+	int64_t t_decimate;
+	int n_subnormal;
+};
+
+static void oim__engine_render_layer(void* usr, int i)
+{
+	struct oim__engine* e = usr;
+	struct oim__layer* l = &e->layers[i];
+	const int n = e->render_n_frames;
+	if (!e->planar) {
+		float* buffer = i == 0 ? e->render_buffer : l->buffer;
+		l->process_fn(e->render_sample_rate, n, buffer, l->usr, &l->input);
+		return;
+	}
+
+	float* const* planes = i == 0 ? e->planes : l->planes;
+	if (l->planar_fn != NULL) {
+		l->planar_fn(e->render_sample_rate, n, planes, l->usr, &l->input);
+	} else {
+		l->process_fn(e->render_sample_rate, n, l->buffer, l->usr, &l->input);
+		for (int ch = 0; ch < OIM_N_CHANNELS; ch++) {
+			float* dst = planes[ch];
+			const float* src = &l->buffer[ch];
+			for (int j = 0; j < n; j++) dst[j] = src[j * OIM_N_CHANNELS];
+		}
+	}
+	/* the others add a mono layer's one channel to every channel; the
+	 * first has none to add to */
+	if (i == 0 && l->n_channels < e->n_planes) {
+		for (int ch = 1; ch < e->n_planes; ch++) oim__k->copy(planes[ch], planes[0], n);
+	}
+}
+
+/* process_fn, if not NULL, becomes the first layer, on --midi-channel.
+ * the engine is sized for renders of up to max_frames frames, and a
+ * realtime engine's memory is locked before it returns */
+static void oim__engine_init(struct oim__engine* e, int oversample_ratio, int oversample_zero_crossings, oim_process_fn process_fn, void* process_fn_usr, int max_frames, int realtime)
+{
+	assert(oversample_ratio >= 1);
+	assert(max_frames >= 1);
+	memset(e, 0, sizeof *e);
+	e->oversample_ratio = oversample_ratio;
+	e->max_frames = max_frames;
+	oim__kernels_get();
+	oim__arena_init(&e->arena);
+	struct oim__arena* arena = &e->arena;
+	const int n_oversampled = max_frames * oversample_ratio;
+
+	e->layers = oim__arena_alloc(arena, (oim__n_layers + 1) * sizeof *e->layers);
+	e->main_layer = -1;
+	if (process_fn != NULL) {
+		e->main_layer = e->n_layers;
+		struct oim__layer* l = &e->layers[e->n_layers++];
+		l->midi_channel = oim__config.midi_channel;
+		l->process_fn = process_fn;
+		l->usr = process_fn_usr;
+	}
+	for (int i = 0; i < oim__n_layers; i++) {
+		struct oim__layer* l = &e->layers[e->n_layers++];
+		*l = oim__layers[i];
+		if (l->midi_channel == OIM__MIDI_CHANNEL_MAIN) {
+			if (e->main_layer < 0) e->main_layer = e->n_layers - 1;
+			l->midi_channel = oim__config.midi_channel;
+		}
+	}
+	if (e->n_layers == 0) {
+		fprintf(stderr, "nothing to render; no process_fn and no layers\n");
+		exit(EXIT_FAILURE);
+	}
+
+	e->n_planes = 1;
+	for (int i = 0; i < e->n_layers; i++) {
+		e->planar |= e->layers[i].planar_fn != NULL;
+		if (e->layers[i].n_channels > 1) e->n_planes = OIM_N_CHANNELS;
+	}
+	e->plane_sz = (n_oversampled + 15) & ~15;
+	for (int i = 0; i < e->n_layers; i++) {
+		struct oim__layer* l = &e->layers[i];
+		if ((!e->planar && i > 0) || (e->planar && l->planar_fn == NULL)) l->buffer = oim__arena_floats(arena, n_oversampled * OIM_N_CHANNELS);
+		if (e->planar && i > 0) oim__alloc_planes(arena, l->planes, l->n_channels, e->plane_sz);
+	}
+	if (e->planar) {
+		oim__alloc_planes(arena, e->planes, e->n_planes, e->plane_sz);
+		for (int ch = 0; ch < e->n_planes; ch++) {
+			oim__decimator_init(&e->plane_decimators[ch], arena, oim__decimator_kind_from_env(), oversample_ratio, oversample_zero_crossings, 1);
+		}
+	}
+
+	int n_workers = oim__config.n_workers;
+	if (n_workers < 0) {
+		const long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		n_workers = (e->n_layers < n_cpus ? e->n_layers : (int)n_cpus) - 1;
+	}
+	if (n_workers > e->n_layers - 1) n_workers = e->n_layers - 1;
+	if (n_workers < 0) n_workers = 0;
+	oim__pool_init(&e->pool, n_workers, e->n_layers, oim__engine_render_layer, e, realtime);
+
+	if (!e->planar) e->tmp_buffer = oim__arena_floats(arena, n_oversampled * OIM_N_CHANNELS);
+	if (!e->planar && oversample_ratio > 1) {
+		oim__decimator_init(&e->decimator, arena, oim__decimator_kind_from_env(), oversample_ratio, oversample_zero_crossings, OIM_N_CHANNELS);
+	}
+	e->out = oim__arena_floats(arena, max_frames * OIM_N_CHANNELS);
+	oim__arena_seal(arena, realtime);
+}
+
+static void oim__engine_free(struct oim__engine* e)
+{
+	oim__pool_free(&e->pool);
+	oim__arena_free(&e->arena);
+}
+
+/* forgets all history, e.g. after the stream was interrupted */
+static void oim__engine_reset(struct oim__engine* e)
+{
+	oim_decimator_reset(&e->decimator);
+	for (int ch = 0; e->planar && ch < e->n_planes; ch++) oim_decimator_reset(&e->plane_decimators[ch]);
+}
+
+/* subnormals in the output usually mean subnormals in some filter state
+ * too, which on x86 costs a microcode assist per operation */
+static int oim__has_subnormals(const float* xs, int n)
+{
+	uint32_t any = 0;
+	for (int i = 0; i < n; i++) {
+		uint32_t u;
+		memcpy(&u, &xs[i], sizeof u);
+		any |= ((u & 0x7f800000) == 0) & ((u & 0x007fffff) != 0);
+	}
+	return any;
+}
+
+/* every layer gets the controls, and the note events on its channel */
+static void oim__engine_layer_inputs(struct oim__engine* e, const struct oim_input* input)
+{
+	for (int i = 0; i < e->n_layers; i++) {
+		struct oim__layer* l = &e->layers[i];
+		struct oim_input* in = &l->input;
+		memcpy(in, input, offsetof(struct oim_input, n_note_events));
+		in->n_note_events = 0;
+		for (int j = 0; j < input->n_note_events; j++) {
+			const struct oim_note_event* ev = &input->note_events[j];
+			if (l->midi_channel != 0 && ev->channel != (l->midi_channel - 1)) continue;
+			in->note_events[in->n_note_events++] = *ev;
+		}
+	}
+}
+
+/* renders every layer at sample_rate, and sums them into buffer, or
+ * into the planes of a planar engine */
+static void oim__engine_process(struct oim__engine* e, unsigned int sample_rate, int n_frames, float* buffer)
+{
+	e->render_sample_rate = sample_rate;
+	e->render_n_frames = n_frames;
+	e->render_buffer = buffer;
+	oim__pool_run(&e->pool);
+	for (int i = 1; i < e->n_layers; i++) {
+		const struct oim__layer* l = &e->layers[i];
+		if (!e->planar) {
+			for (int j = 0; j < (n_frames * OIM_N_CHANNELS); j++) buffer[j] += l->buffer[j];
+			continue;
+		}
+		for (int ch = 0; ch < e->n_planes; ch++) {
+			float* dst = e->planes[ch];
+			const float* src = l->planes[l->n_channels == 1 ? 0 : ch];
+			for (int j = 0; j < n_frames; j++) dst[j] += src[j];
+		}
+	}
+}
+
+/* the device edge of a planar engine */
+static void oim__engine_interleave(struct oim__engine* e, int n_frames, void* buffer)
+{
+	const float* src[OIM_N_CHANNELS];
+	for (int ch = 0; ch < OIM_N_CHANNELS; ch++) src[ch] = e->planes[e->n_planes == 1 ? 0 : ch];
+	if (e->quantizer == NULL) {
+		float* dst = buffer;
+		for (int i = 0; i < n_frames; i++) {
+			for (int ch = 0; ch < OIM_N_CHANNELS; ch++) dst[i * OIM_N_CHANNELS + ch] = src[ch][i];
+		}
+		return;
+	}
+
+	/* quantized a chunk at a time, as it's interleaved */
+	const int chunk = OIM__QUANTIZE_CHUNK / OIM_N_CHANNELS > 0 ? OIM__QUANTIZE_CHUNK / OIM_N_CHANNELS : 1;
+	float tmp[chunk * OIM_N_CHANNELS];
+	for (int i0 = 0; i0 < n_frames; i0 += chunk) {
+		const int n = (n_frames - i0) < chunk ? (n_frames - i0) : chunk;
+		for (int i = 0; i < n; i++) {
+			for (int ch = 0; ch < OIM_N_CHANNELS; ch++) tmp[i * OIM_N_CHANNELS + ch] = src[ch][i0 + i];
+		}
+		oim__quantize(e->quantizer, (uint8_t*)buffer + i0 * OIM_N_CHANNELS * e->quantizer->bytes, tmp, n * OIM_N_CHANNELS);
+	}
+}
+
+static void oim__engine_render_planar(struct oim__engine* e, unsigned int sample_rate, int n_frames, void* buffer)
+{
+	const int R = e->oversample_ratio;
+	assert(n_frames <= e->max_frames);
+
+	int64_t t0 = 0, t1 = 0;
+	if (e->timed) t0 = oim__now_ns();
+
+	oim__engine_process(e, sample_rate * R, n_frames * R, NULL);
+	if (e->timed) {
+		t1 = oim__now_ns();
+		int any = 0;
+		for (int ch = 0; ch < e->n_planes; ch++) any |= oim__has_subnormals(e->planes[ch], n_frames * R);
+		e->n_subnormal += any;
+	}
+	if (R > 1) {
+		for (int ch = 0; ch < e->n_planes; ch++) {
+			oim_decimator_process(&e->plane_decimators[ch], e->planes[ch], n_frames * R, e->planes[ch]);
+		}
+	}
+	oim__engine_interleave(e, n_frames, buffer);
+	if (e->timed) {
+		int64_t t2 = oim__now_ns();
+		e->t_process += t1 - t0;
+		e->t_decimate += t2 - t1;
+	}
+}
+
+/* renders n_frames interleaved frames into buffer: floats, or samples
+ * in the quantizer's format if the engine has one */
+static void oim__engine_render(struct oim__engine* e, unsigned int sample_rate, int n_frames, void* buffer, struct oim_input* input)
+{
+	const int R = e->oversample_ratio;
+	assert(n_frames <= e->max_frames);
+
+	int64_t t0 = 0, t1 = 0;
+	if (e->timed) t0 = oim__now_ns();
+
+	oim__engine_layer_inputs(e, input);
+
+	if (e->planar) {
+		oim__engine_render_planar(e, sample_rate, n_frames, buffer);
+	} else if (R > 1) {
+		oim__engine_process(e, sample_rate * R, n_frames * R, e->tmp_buffer);
+		if (e->timed) {
+			t1 = oim__now_ns();
+			e->n_subnormal += oim__has_subnormals(e->tmp_buffer, n_frames * R * OIM_N_CHANNELS);
+		}
+		if (e->quantizer == NULL) {
+			oim_decimator_process(&e->decimator, e->tmp_buffer, n_frames * R, buffer);
+		} else {
+			oim__decimator_process_quantized(&e->decimator, e->tmp_buffer, n_frames * R, buffer, e->quantizer);
+		}
+		if (e->timed) {
+			int64_t t2 = oim__now_ns();
+			e->t_process += t1 - t0;
+			e->t_decimate += t2 - t1;
+		}
+
+		#if DEBUG
+		/* quantizing leaves the floats in tmp_buffer */
+		const float* out = e->quantizer == NULL ? buffer : e->tmp_buffer;
+		for (int i = 0; i < (n_frames * OIM_N_CHANNELS); i += OIM_N_CHANNELS) {
+			printf("%.4d\t%.6f\t", i, out[i]);
+
+			int W = 50;
+			int X = (int)(((out[i] + 1.0) / 2.0f) * (float)W);
+			for (int x = 0; x < W; x++) {
+				putchar(x == X ? '*' : x == W/2 ? '|' : ' ');
+			}
+			putchar('\n');
+		}
+		#endif
+	} else {
+		float* out = e->quantizer == NULL ? buffer : e->tmp_buffer;
+		oim__engine_process(e, sample_rate, n_frames, out);
+		if (e->timed) {
+			e->t_process += oim__now_ns() - t0;
+			e->n_subnormal += oim__has_subnormals(out, n_frames * OIM_N_CHANNELS);
+		}
+		if (e->quantizer != NULL) oim__quantize(e->quantizer, buffer, out, n_frames * OIM_N_CHANNELS);
+	}
+	input->n_note_events = 0;
+}
+
+/* offline rendering; drives the same engine as oim_run, but without
+ * any devices and as fast as possible.
+ *
+ * script_path (optional) is a text file of timed input events, one per
+ * line, in the order they happen:
+ *   <seconds> pen <x> <y> <pressure>
+ *   <seconds> note <note> <velocity> [<channel>]
+ * a velocity of 0 is a note off, and channel is 1-16 (1). blank lines
+ * and lines starting with # are ignored. note events land on the exact
+ * frame; pen changes take effect at the start of the period they fall
+ * in, same as live input.
+ *
+ * output_path (optional) ending in .wav gets a 32-bit float WAV file;
+ * anything else gets raw interleaved native-endian floats ("-" is
+ * stdout). without it the output is discarded */
+
+struct oim__script_event {
+	double t;
+	char what[16];
+	float a, b, c;
+};
+
+static int oim__script_next(FILE* f, int* line, struct oim__script_event* ev)
+{
+	char buf[256];
+	while (fgets(buf, sizeof buf, f) != NULL) {
+		(*line)++;
+		char* p = buf;
+		while (*p == ' ' || *p == '\t') p++;
+		if (*p == '#' || *p == '\n' || *p == 0) continue;
+		int n = sscanf(p, "%lf %15s %f %f %f", &ev->t, ev->what, &ev->a, &ev->b, &ev->c);
+		if (strcmp(ev->what, "note") == 0 && n == 4) ev->c = 1;
+		if ((strcmp(ev->what, "pen") == 0 && n == 5) || (strcmp(ev->what, "note") == 0 && n >= 4 && ev->c >= 1 && ev->c <= 16)) return 1;
+		fprintf(stderr, "script line %d: cannot parse: %s", *line, buf);
+		exit(EXIT_FAILURE);
+	}
+	return 0;
+}
+
+static void oim__script_apply(struct oim__script_event* ev, struct oim_input* input, uint32_t frame)
+{
+	if (strcmp(ev->what, "pen") == 0) {
+		input->pen_x = ev->a;
+		input->pen_y = ev->b;
+		input->pen_pressure = ev->c;
+	} else if (input->n_note_events < OIM_MAX_NOTE_EVENTS) {
+		struct oim_note_event* nev = &input->note_events[input->n_note_events++];
+		nev->note = (uint8_t)ev->a;
+		nev->channel = (uint8_t)ev->c - 1;
+		nev->velocity = ev->b;
+		nev->frame = frame;
+	}
+}
+
+static void oim__put_u32le(uint8_t* p, uint32_t v)
+{
+	for (int i = 0; i < 4; i++) p[i] = (v >> (i*8)) & 0xff;
+}
+
+static void oim__put_u16le(uint8_t* p, uint16_t v)
+{
+	for (int i = 0; i < 2; i++) p[i] = (v >> (i*8)) & 0xff;
+}
+
+/* past 4GiB of data, which is 3.1 hours at 48kHz in stereo, the sizes
+ * stay at 0xffffffff, which most readers take to mean "up to the end of
+ * the file" */
+static void oim__wav_header(uint8_t* h, unsigned int sample_rate, int n_channels, uint64_t n_frames)
+{
+	const uint64_t sz = n_frames * n_channels * sizeof(float);
+	const uint32_t data_sz = sz < (0xffffffffu - 36) ? sz : 0xffffffffu;
+	memcpy(&h[0], "RIFF", 4);
+	oim__put_u32le(&h[4], sz < (0xffffffffu - 36) ? 36 + data_sz : 0xffffffffu);
+	memcpy(&h[8], "WAVEfmt ", 8);
+	oim__put_u32le(&h[16], 16);
+	oim__put_u16le(&h[20], 3); // IEEE float
+	oim__put_u16le(&h[22], n_channels);
+	oim__put_u32le(&h[24], sample_rate);
+	oim__put_u32le(&h[28], sample_rate * n_channels * sizeof(float));
+	oim__put_u16le(&h[32], n_channels * sizeof(float));
+	oim__put_u16le(&h[34], 32);
+	memcpy(&h[36], "data", 4);
+	oim__put_u32le(&h[40], data_sz);
+}
+
+#define OIM__WAV_HEADER_SZ (44)
+
+/* what every entry point needs before it renders: the configuration,
+ * checked, and the math and wave tables. safe to call more than once */
+static void oim__init()
+{
+	oim__config_init();
+	oim__config_check();
+	oim__math_init();
+	oim__wavetables_load();
+}
+
+/* further down, with the rest of the input handling */
+struct oim__replay_offline;
+static struct oim__replay_offline* oim__replay_offline_open(const char* path);
+static void oim__replay_offline_block(struct oim__replay_offline* r, struct oim_input* input, uint64_t frame, uint32_t n_frames, unsigned int sample_rate, int oversample_ratio);
+
+void oim_render_offline(int oversample_ratio, int oversample_zero_crossings, oim_process_fn process_fn, void* process_fn_usr, double seconds, const char* script_path, const char* output_path)
+{
+	if (!(seconds > 0.0)) {
+		fprintf(stderr, "offline: %g seconds; must be more than 0\n", seconds);
+		exit(EXIT_FAILURE);
+	}
+	oim__init();
+	const unsigned int sample_rate = oim__config.sample_rate;
+	const int period_size = oim__config.period_size;
+
+	struct oim__engine engine;
+	oim__engine_init(&engine, oversample_ratio, oversample_zero_crossings, process_fn, process_fn_usr, period_size, 0);
+	float* buffer = engine.out;
+
+	struct oim_input input;
+	memset(&input, 0, sizeof input);
+
+	FILE* script = NULL;
+	int script_line = 0;
+	struct oim__script_event ev;
+	int have_ev = 0;
+	if (script_path != NULL) {
+		script = fopen(script_path, "r");
+		if (script == NULL) {
+			fprintf(stderr, "%s: %s\n", script_path, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		have_ev = oim__script_next(script, &script_line, &ev);
+	}
+
+	/* --replay plays a capture back, in place of a live session */
+	struct oim__replay_offline* replay = NULL;
+	if (oim__config.replay != NULL) replay = oim__replay_offline_open(oim__config.replay);
+
+	FILE* out = NULL;
+	int wav = 0;
+	if (output_path != NULL) {
+		if (strcmp(output_path, "-") == 0) {
+			out = stdout;
+		} else {
+			out = fopen(output_path, "wb");
+			if (out == NULL) {
+				fprintf(stderr, "%s: %s\n", output_path, strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+			size_t n = strlen(output_path);
+			wav = n >= 4 && strcasecmp(&output_path[n-4], ".wav") == 0;
+		}
+		if (wav) {
+			uint8_t h[OIM__WAV_HEADER_SZ];
+			oim__wav_header(h, sample_rate, OIM_N_CHANNELS, 0);
+			fwrite(h, sizeof h, 1, out);
+		}
+	}
+
+	const uint64_t n_total = (uint64_t)(seconds * (double)sample_rate);
+	uint64_t n_done = 0;
+	double t_render = 0.0;
+	while (n_done < n_total) {
+		int n = period_size;
+		if ((n_total - n_done) < n) n = n_total - n_done;
+
+		const double t_end = (double)(n_done + n) / (double)sample_rate;
+		while (have_ev && ev.t < t_end && input.n_note_events < OIM_MAX_NOTE_EVENTS) {
+			double frame = (ev.t * (double)sample_rate - (double)n_done) * (double)oversample_ratio;
+			oim__script_apply(&ev, &input, frame > 0.0 ? (uint32_t)frame : 0);
+			have_ev = oim__script_next(script, &script_line, &ev);
+		}
+		if (replay != NULL) oim__replay_offline_block(replay, &input, n_done, n, sample_rate, oversample_ratio);
+
+		double t0 = oim__now();
+		oim__engine_render(&engine, sample_rate, n, buffer, &input);
+		t_render += oim__now() - t0;
+
+		if (out != NULL && fwrite(buffer, sizeof *buffer * OIM_N_CHANNELS, n, out) != n) {
+			fprintf(stderr, "write error: %s\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		n_done += n;
+	}
+
+	if (script != NULL) fclose(script);
+	if (out != NULL) {
+		if (wav) {
+			uint8_t h[OIM__WAV_HEADER_SZ];
+			oim__wav_header(h, sample_rate, OIM_N_CHANNELS, n_done);
+			fseek(out, 0, SEEK_SET);
+			fwrite(h, sizeof h, 1, out);
+		}
+		if (out != stdout) fclose(out);
+	}
+
+	fprintf(stderr, "offline: %lu frames in %.3fs; %.0f frames/s; %.1fx realtime\n",
+		(unsigned long)n_done,
+		t_render,
+		(double)n_done / t_render,
+		((double)n_done / (double)sample_rate) / t_render);
+
+	oim__engine_free(&engine);
+}
+
+/* benchmark mode; prints one JSON object per line on stdout with the
+ * cost in ns per output frame of the process function, of the
+ * decimator for every kind and kernel set this cpu supports (at the
+ * engine's own ratio, and at the ones it's tracked at, below), and of
+ * the whole engine. the decimator is timed interleaved, over all channels
+ * at once, and for planar engines also the way they run it, as one
+ * single-channel decimator per plane; "layout" tells the two apart.
+ * OIM_BENCH_NAME and OIM_BENCH_REV are copied into every
+ * line if set, so results can be tracked across builds and commits */
+
+#define OIM__BENCH_PERIODS (1000)
+#define OIM__BENCH_RUNS (5)
+
+static void oim__bench_input(struct oim_input* input, int period, int n_periods)
+{
+	static const uint8_t chord[] = { 60, 64, 67, 72 };
+	input->pen_x = (float)period / (float)n_periods;
+	input->pen_y = 0.5f;
+	input->pen_pressure = 0.8f;
+	if (period == 0) {
+		for (int i = 0; i < sizeof chord; i++) {
+			input->note_events[input->n_note_events].note = chord[i];
+			input->note_events[input->n_note_events].velocity = 1.0f;
+			input->note_events[input->n_note_events].frame = 0;
+			input->n_note_events++;
+		}
+	}
+}
+
+static void oim__bench_line(const char* what, const char* decimator, const char* layout, const char* simd, int ratio, int zero_crossings, double ns_per_frame)
+{
+	const char* name = getenv("OIM_BENCH_NAME");
+	const char* rev = getenv("OIM_BENCH_REV");
+	printf("{\"name\":\"%s\"", name != NULL ? name : program_invocation_short_name);
+	if (rev != NULL) printf(",\"rev\":\"%s\"", rev);
+	printf(",\"what\":\"%s\"", what);
+	if (decimator != NULL) printf(",\"decimator\":\"%s\"", decimator);
+	if (layout != NULL) printf(",\"layout\":\"%s\"", layout);
+	if (simd != NULL) printf(",\"simd\":\"%s\"", simd);
+	printf(",\"channels\":%d,\"ratio\":%d,\"zero_crossings\":%d,\"ns_per_frame\":%.3f}\n",
+		OIM_N_CHANNELS,
+		ratio,
+		zero_crossings,
+		ns_per_frame);
+	fflush(stdout);
+}
+
+#if !OIM_LIBM
+#define OIM__BENCH_MATH_N (4096)
+#define OIM__BENCH_MATH_REPS (100)
+
+/* times f over every element of in, in ns per call */
+#define OIM__BENCH_MATH(f, in, out) ({ \
+	double best = 1e30; \
+	for (int run = 0; run < OIM__BENCH_RUNS; run++) { \
+		double t0 = oim__now(); \
+		for (int rep = 0; rep < OIM__BENCH_MATH_REPS; rep++) { \
+			for (int i = 0; i < OIM__BENCH_MATH_N; i++) (out)[i] = f((in)[i]); \
+			__asm__ __volatile__("" : : "r"(out) : "memory"); \
+		} \
+		double dt = oim__now() - t0; \
+		if (dt < best) best = dt; \
+	} \
+	best * 1e9 / (double)(OIM__BENCH_MATH_REPS * OIM__BENCH_MATH_N); \
+})
+
+static inline float oim__libm_sin2pi(float phase) { return sinf(phase * (float)OIM_PI2); }
+static inline float oim__libm_note_hz(float note) { return 440.0f * powf(2.0f, (note - 69.0f) / 12.0f); }
+
+static void oim__bench_math_line(const char* fn, double libm_ns, double oim_ns)
+{
+	const char* name = getenv("OIM_BENCH_NAME");
+	const char* rev = getenv("OIM_BENCH_REV");
+	printf("{\"name\":\"%s\"", name != NULL ? name : program_invocation_short_name);
+	if (rev != NULL) printf(",\"rev\":\"%s\"", rev);
+	printf(",\"what\":\"math\",\"fn\":\"%s\",\"libm_ns_per_call\":%.3f,\"oim_ns_per_call\":%.3f}\n", fn, libm_ns, oim_ns);
+	fflush(stdout);
+}
+
+static void oim__bench_math()
+{
+	float* in = oim__alloc_float_array(OIM__BENCH_MATH_N);
+	float* out = oim__alloc_float_array(OIM__BENCH_MATH_N);
+	double libm_ns, oim_ns;
+
+	for (int i = 0; i < OIM__BENCH_MATH_N; i++) in[i] = -20.0f + 40.0f * (float)i / (float)OIM__BENCH_MATH_N;
+	libm_ns = OIM__BENCH_MATH(exp2f, in, out);
+	oim_ns = OIM__BENCH_MATH(oim_exp2, in, out);
+	oim__bench_math_line("exp2", libm_ns, oim_ns);
+
+	libm_ns = OIM__BENCH_MATH(tanhf, in, out);
+	oim_ns = OIM__BENCH_MATH(oim_tanh, in, out);
+	oim__bench_math_line("tanh", libm_ns, oim_ns);
+
+	for (int i = 0; i < OIM__BENCH_MATH_N; i++) in[i] = (float)i / (float)OIM__BENCH_MATH_N;
+	libm_ns = OIM__BENCH_MATH(oim__libm_sin2pi, in, out);
+	oim_ns = OIM__BENCH_MATH(oim_sin2pi, in, out);
+	oim__bench_math_line("sin2pi", libm_ns, oim_ns);
+
+	for (int i = 0; i < OIM__BENCH_MATH_N; i++) in[i] = 127.0f * (float)i / (float)OIM__BENCH_MATH_N;
+	libm_ns = OIM__BENCH_MATH(oim__libm_note_hz, in, out);
+	oim_ns = OIM__BENCH_MATH(oim_note_hz, in, out);
+	oim__bench_math_line("note_hz", libm_ns, oim_ns);
+
+	free(in);
+	free(out);
+}
+#endif
+
+/* the (ratio, zero crossings) pairs the decimator is always timed at,
+ * besides the engine's own: oscpen's and pwmpen's from before they had
+ * band-limited oscillators */
+#define OIM__BENCH_N_DECIMATORS (2)
+static const int oim__bench_decimators_tracked[OIM__BENCH_N_DECIMATORS][2] = { { 16, 3 }, { 10, 2 } };
+
+/* times every kind of decimator with every kernel set this cpu
+ * supports, at ratio R, on period_size * R frames of interleaved src,
+ * and, given n_planes planes of plane_src, the way a planar engine runs
+ * them, as one single-channel decimator per plane. out takes
+ * period_size frames */
+static void oim__bench_decimators(int R, int zero_crossings, int period_size, const float* src, const float* plane_src, int n_planes, float* out)
+{
+	const int n_in = period_size * R;
+	/* decimation clobbers its input, so it's copied every time */
+	float* tmp_buffer = oim__alloc_float_array(n_in * OIM_N_CHANNELS);
+	const struct oim__kernels* k0 = oim__k;
+	double best;
+	for (int kind = 0; kind < OIM_DECIMATOR_N_KINDS; kind++) {
+		for (const struct oim__kernels** k = oim__kernels_available; *k != NULL; k++) {
+			if (!oim__kernels_supported(*k)) continue;
+			oim__k = *k;
+			struct oim_decimator dec;
+			oim_decimator_init(&dec, kind, R, zero_crossings, OIM_N_CHANNELS);
+			best = 1e30;
+			for (int run = 0; run < OIM__BENCH_RUNS; run++) {
+				double dt = 0.0;
+				for (int i = 0; i < OIM__BENCH_PERIODS; i++) {
+					memcpy(tmp_buffer, src, n_in * OIM_N_CHANNELS * sizeof *src);
+					double t0 = oim__now();
+					oim_decimator_process(&dec, tmp_buffer, n_in, out);
+					dt += oim__now() - t0;
+				}
+				if (dt < best) best = dt;
+			}
+			oim_decimator_free(&dec);
+			oim__bench_line("decimator", oim__decimator_kind_names[kind], "interleaved", (*k)->name, R, zero_crossings, best * 1e9 / (double)(OIM__BENCH_PERIODS * period_size));
+
+			if (n_planes == 0) continue;
+			struct oim_decimator plane_decs[OIM_N_CHANNELS];
+			for (int ch = 0; ch < n_planes; ch++) oim_decimator_init(&plane_decs[ch], kind, R, zero_crossings, 1);
+			best = 1e30;
+			for (int run = 0; run < OIM__BENCH_RUNS; run++) {
+				double dt = 0.0;
+				for (int i = 0; i < OIM__BENCH_PERIODS; i++) {
+					for (int ch = 0; ch < n_planes; ch++) {
+						memcpy(tmp_buffer, &plane_src[ch * n_in], n_in * sizeof *plane_src);
+						double t0 = oim__now();
+						oim_decimator_process(&plane_decs[ch], tmp_buffer, n_in, out);
+						dt += oim__now() - t0;
+					}
+				}
+				if (dt < best) best = dt;
+			}
+			for (int ch = 0; ch < n_planes; ch++) oim_decimator_free(&plane_decs[ch]);
+			oim__bench_line("decimator", oim__decimator_kind_names[kind], "planar", (*k)->name, R, zero_crossings, best * 1e9 / (double)(OIM__BENCH_PERIODS * period_size));
+		}
+	}
+	oim__k = k0;
+	free(tmp_buffer);
+}
+
+void oim_bench(int oversample_ratio, int oversample_zero_crossings, oim_process_fn process_fn, void* process_fn_usr)
+{
+	oim__init();
+	const unsigned int sample_rate = OIM__DEFAULT_SAMPLE_RATE;
+	const int period_size = OIM__DEFAULT_PERIOD_SIZE;
+	const int R = oversample_ratio;
+	const int n_in = period_size * R;
+	const char* simd = oim__kernels_get()->name;
+
+	struct oim_input input;
+	memset(&input, 0, sizeof input);
+
+	struct oim__engine engine;
+	oim__engine_init(&engine, oversample_ratio, oversample_zero_crossings, process_fn, process_fn_usr, period_size, 0);
+	float* buffer = engine.out;
+	float* tmp_buffer = oim__alloc_float_array(n_in * OIM_N_CHANNELS);
+
+	/* the best of a few runs filters out most scheduling noise */
+	double best;
+
+	best = 1e30;
+	for (int run = 0; run < OIM__BENCH_RUNS; run++) {
+		double dt = 0.0;
+		for (int i = 0; i < OIM__BENCH_PERIODS; i++) {
+			oim__bench_input(&input, i, OIM__BENCH_PERIODS);
+			double t0 = oim__now();
+			oim__engine_layer_inputs(&engine, &input);
+			oim__engine_process(&engine, sample_rate * R, n_in, tmp_buffer);
+			dt += oim__now() - t0;
+			input.n_note_events = 0;
+		}
+		if (dt < best) best = dt;
+	}
+	oim__bench_line("process", NULL, NULL, NULL, R, oversample_zero_crossings, best * 1e9 / (double)(OIM__BENCH_PERIODS * period_size));
+
+	if (engine.planar) oim__engine_interleave(&engine, n_in, tmp_buffer);
+
+	if (R > 1) {
+		/* process output makes for realistic decimator input */
+		const int n_planes = engine.planar ? engine.n_planes : 0;
+		float* plane_src = NULL;
+		if (n_planes > 0) {
+			plane_src = oim__alloc_float_array(n_in * n_planes);
+			for (int ch = 0; ch < n_planes; ch++) memcpy(&plane_src[ch * n_in], engine.planes[ch], n_in * sizeof *plane_src);
+		}
+		oim__bench_decimators(R, oversample_zero_crossings, period_size, tmp_buffer, plane_src, n_planes, buffer);
+		free(plane_src);
+	}
+
+	/* and the ratios the instruments have run at, whatever this one
+	 * runs at, on a test signal */
+	for (int i = 0; i < OIM__BENCH_N_DECIMATORS; i++) {
+		const int r = oim__bench_decimators_tracked[i][0];
+		const int zc = oim__bench_decimators_tracked[i][1];
+		if (r == R && zc == oversample_zero_crossings) continue;
+		const int n = period_size * r;
+		float* src = oim__alloc_float_array(n * OIM_N_CHANNELS);
+		float* plane_src = oim__alloc_float_array(n * OIM_N_CHANNELS);
+		for (int j = 0; j < n; j++) {
+			for (int ch = 0; ch < OIM_N_CHANNELS; ch++) {
+				const float v = 0.5f * oim_sin2pi((float)((j * (7 + ch)) % 1024) / 1024.0f);
+				src[j * OIM_N_CHANNELS + ch] = v;
+				plane_src[ch * n + j] = v;
+			}
+		}
+		oim__bench_decimators(r, zc, period_size, src, engine.planar ? plane_src : NULL, engine.planar ? OIM_N_CHANNELS : 0, buffer);
+		free(src);
+		free(plane_src);
+	}
+
+	best = 1e30;
+	for (int run = 0; run < OIM__BENCH_RUNS; run++) {
+		double t0 = oim__now();
+		for (int i = 0; i < OIM__BENCH_PERIODS; i++) {
+			oim__bench_input(&input, i, OIM__BENCH_PERIODS);
+			oim__engine_render(&engine, sample_rate, period_size, buffer, &input);
+		}
+		double dt = oim__now() - t0;
+		if (dt < best) best = dt;
+	}
+	oim__bench_line("engine", R > 1 ? oim__decimator_kind_names[oim__decimator_kind_from_env()] : NULL, NULL, simd, R, oversample_zero_crossings, best * 1e9 / (double)(OIM__BENCH_PERIODS * period_size));
+
+	#if !OIM_LIBM
+	oim__bench_math();
+	#endif
+
+	free(tmp_buffer);
+	oim__engine_free(&engine);
+}
+
+/* lock-free single-producer/single-consumer ring of fixed size
+ * elements; capacity must be a power of two */
+struct oim__spsc {
+	uint32_t elem_sz;
+	uint32_t mask;
+	uint8_t* data;
+	uint32_t head __attribute__((aligned(64))); // written by producer only
+	uint32_t tail __attribute__((aligned(64))); // written by consumer only
+};
+
+static void oim__spsc_init(struct oim__spsc* r, uint32_t elem_sz, uint32_t capacity)
+{
+	assert((capacity & (capacity - 1)) == 0);
+	memset(r, 0, sizeof *r);
+	r->elem_sz = elem_sz;
+	r->mask = capacity - 1;
+	r->data = calloc(capacity, elem_sz);
+	assert(r->data != NULL);
+}
+
+static int oim__spsc_push(struct oim__spsc* r, const void* elem)
+{
+	const uint32_t head = r->head;
+	const uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	if ((head - tail) > r->mask) return 0;
+	memcpy(&r->data[(head & r->mask) * r->elem_sz], elem, r->elem_sz);
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+/* returns the oldest element without removing it, or NULL if empty */
+static void* oim__spsc_peek(struct oim__spsc* r)
+{
+	const uint32_t tail = r->tail;
+	const uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	if (head == tail) return NULL;
+	return &r->data[(tail & r->mask) * r->elem_sz];
+}
+
+static void oim__spsc_drop(struct oim__spsc* r)
+{
+	__atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+}
+
+/* input side -> audio side. pen state is continuous, so only the latest
+ * snapshot matters; it's published under a sequence lock (the writer
+ * never waits, and a reader only retries if it raced a write). note
+ * events must all arrive, so they go through an SPSC ring, stamped with
+ * the time they were read. the audio side places them in the block
+ * such that every event is heard a constant latency after it was read,
+ * instead of at whatever period boundary happens to come next */
+
+#define OIM__NOTE_QUEUE_SZ (1<<12)
+
+struct oim__timed_note_event {
+	int64_t t; // CLOCK_MONOTONIC ns
+	struct oim_note_event ev;
+};
+
+struct oim__input_queue {
+	/* seqlock over the continuous controls */
+	uint32_t seq;
+	float pen_x, pen_y, pen_pressure;
+	uint32_t touch_active;
+	float touch_x[OIM_MAX_TOUCHES], touch_y[OIM_MAX_TOUCHES], touch_pressure[OIM_MAX_TOUCHES];
+	float midi_cc[128];
+	float midi_pitch_bend;
+	struct oim__spsc notes;
+	uint32_t n_notes_dropped;
+};
+
+static void oim__input_queue_init(struct oim__input_queue* q)
+{
+	memset(q, 0, sizeof *q);
+	oim__spsc_init(&q->notes, sizeof(struct oim__timed_note_event), OIM__NOTE_QUEUE_SZ);
+}
+
+static void oim__input_queue_publish(struct oim__input_queue* q, const struct oim_input* input)
+{
+	const uint32_t seq = q->seq;
+	__atomic_store_n(&q->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store(&q->pen_x, &input->pen_x, __ATOMIC_RELAXED);
+	__atomic_store(&q->pen_y, &input->pen_y, __ATOMIC_RELAXED);
+	__atomic_store(&q->pen_pressure, &input->pen_pressure, __ATOMIC_RELAXED);
+	__atomic_store_n(&q->touch_active, input->touch_active, __ATOMIC_RELAXED);
+	for (int i = 0; i < OIM_MAX_TOUCHES; i++) {
+		__atomic_store(&q->touch_x[i], &input->touch_x[i], __ATOMIC_RELAXED);
+		__atomic_store(&q->touch_y[i], &input->touch_y[i], __ATOMIC_RELAXED);
+		__atomic_store(&q->touch_pressure[i], &input->touch_pressure[i], __ATOMIC_RELAXED);
+	}
+	for (int i = 0; i < 128; i++) __atomic_store(&q->midi_cc[i], &input->midi_cc[i], __ATOMIC_RELAXED);
+	__atomic_store(&q->midi_pitch_bend, &input->midi_pitch_bend, __ATOMIC_RELAXED);
+	__atomic_store_n(&q->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static void oim__input_queue_push_note(struct oim__input_queue* q, const struct oim_note_event* ev, int64_t t)
+{
+	struct oim__timed_note_event tev;
+	tev.t = t;
+	tev.ev = *ev;
+	if (!oim__spsc_push(&q->notes, &tev)) {
+		__atomic_add_fetch(&q->n_notes_dropped, 1, __ATOMIC_RELAXED);
+	}
+}
+
+/* fills in the continuous controls and the queued note events that belong in a block
+ * of n_frames frames, the first of which corresponds to input time
+ * t_block, frame_ns apart. late events go on frame 0; events that
+ * belong to a later block, or don't fit, stay queued */
+static void oim__input_queue_consume(struct oim__input_queue* q, struct oim_input* input, int64_t t_block, double frame_ns, uint32_t n_frames)
+{
+	uint32_t s0, s1;
+	do {
+		s0 = __atomic_load_n(&q->seq, __ATOMIC_ACQUIRE);
+		__atomic_load(&q->pen_x, &input->pen_x, __ATOMIC_RELAXED);
+		__atomic_load(&q->pen_y, &input->pen_y, __ATOMIC_RELAXED);
+		__atomic_load(&q->pen_pressure, &input->pen_pressure, __ATOMIC_RELAXED);
+		input->touch_active = __atomic_load_n(&q->touch_active, __ATOMIC_RELAXED);
+		for (int i = 0; i < OIM_MAX_TOUCHES; i++) {
+			__atomic_load(&q->touch_x[i], &input->touch_x[i], __ATOMIC_RELAXED);
+			__atomic_load(&q->touch_y[i], &input->touch_y[i], __ATOMIC_RELAXED);
+			__atomic_load(&q->touch_pressure[i], &input->touch_pressure[i], __ATOMIC_RELAXED);
+		}
+		for (int i = 0; i < 128; i++) __atomic_load(&q->midi_cc[i], &input->midi_cc[i], __ATOMIC_RELAXED);
+		__atomic_load(&q->midi_pitch_bend, &input->midi_pitch_bend, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		s1 = __atomic_load_n(&q->seq, __ATOMIC_RELAXED);
+	} while ((s0 & 1) || s0 != s1);
+
+	uint32_t frame = 0;
+	struct oim__timed_note_event* tev;
+	while (input->n_note_events < OIM_MAX_NOTE_EVENTS && (tev = oim__spsc_peek(&q->notes)) != NULL) {
+		double f = (double)(tev->t - t_block) / frame_ns;
+		if (f >= (double)n_frames) break;
+		if (f > (double)frame) frame = (uint32_t)f;
+		struct oim_note_event* ev = &input->note_events[input->n_note_events++];
+		*ev = tev->ev;
+		ev->frame = frame;
+		oim__spsc_drop(&q->notes);
+	}
+}
+
+/* MIDI byte stream parser. keeps partial messages across reads, and
+ * running status, so a status byte may be followed by any number of
+ * messages' worth of data bytes. realtime bytes may show up anywhere,
+ * even inside other messages, and are ignored; so are SysEx and system
+ * common messages, which also cancel running status */
+
+struct oim__midi_msg {
+	uint8_t status; // including the channel
+	uint8_t d0;
+	uint8_t d1;
+};
+
+struct oim__midi_parser {
+	uint8_t status; // 0 when data bytes are to be dropped
+	uint8_t n_data;
+	uint8_t data[2];
+};
+
+static int oim__midi_data_length(uint8_t status)
+{
+	switch (status & 0xf0) {
+	case 0xc0: case 0xd0: return 1;
+	case 0xf0: break;
+	default: return 2;
+	}
+	switch (status) {
+	case 0xf1: case 0xf3: return 1;
+	case 0xf2: return 2;
+	}
+	return 0;
+}
+
+/* returns 1 when byte completes a channel message */
+static int oim__midi_parse(struct oim__midi_parser* p, uint8_t byte, struct oim__midi_msg* msg)
+{
+	if (byte >= 0xf8) return 0;
+
+	if (byte & 0x80) {
+		p->n_data = 0;
+		/* SysEx data is dropped like any data without a status;
+		 * system common messages with data keep their status just
+		 * long enough to skip it */
+		p->status = (byte == 0xf0 || byte == 0xf7 || oim__midi_data_length(byte) == 0) ? 0 : byte;
+		return 0;
+	}
+
+	if (p->status == 0) return 0;
+	p->data[p->n_data++] = byte;
+	const int n = oim__midi_data_length(p->status);
+	if (p->n_data < n) return 0;
+	p->n_data = 0;
+	if (p->status >= 0xf0) {
+		p->status = 0;
+		return 0;
+	}
+	msg->status = p->status;
+	msg->d0 = p->data[0];
+	msg->d1 = n == 2 ? p->data[1] : 0;
+	return 1;
+}
+
+/* ALSA sequencer input. its port has the kernel stamp events with the
+ * time they arrived on a queue of ours, which beats taking the time
+ * whenever we get round to reading them. queue time is mapped to
+ * CLOCK_MONOTONIC by an offset measured when the queue starts */
+
+struct oim__midi_seq {
+	snd_seq_t* seq;
+	int port;
+	int queue;
+	int64_t t_offset;
+};
+
+static void oim__midi_seq_close(struct oim__midi_seq* ms)
+{
+	snd_seq_close(ms->seq);
+	ms->seq = NULL;
+}
+
+static void oim__open_midi_seq(struct oim_loop* loop, struct oim_source* src, struct oim__midi_seq* ms)
+{
+	const char* source = oim__config.midi_seq;
+	if (source == NULL || ms->seq != NULL) return;
+
+	int err;
+	if ((err = snd_seq_open(&ms->seq, "default", SND_SEQ_OPEN_INPUT, SND_SEQ_NONBLOCK)) < 0) {
+		ms->seq = NULL;
+		return;
+	}
+	snd_seq_set_client_name(ms->seq, "oim");
+
+	if ((ms->queue = snd_seq_alloc_named_queue(ms->seq, "oim")) < 0) {
+		fprintf(stderr, "snd_seq_alloc_named_queue: %s\n", snd_strerror(ms->queue));
+		oim__midi_seq_close(ms);
+		return;
+	}
+
+	snd_seq_port_info_t* pinfo;
+	snd_seq_port_info_alloca(&pinfo);
+	snd_seq_port_info_set_name(pinfo, "oim in");
+	snd_seq_port_info_set_capability(pinfo, SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE);
+	snd_seq_port_info_set_type(pinfo, SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+	snd_seq_port_info_set_timestamping(pinfo, 1);
+	snd_seq_port_info_set_timestamp_real(pinfo, 1);
+	snd_seq_port_info_set_timestamp_queue(pinfo, ms->queue);
+	if ((err = snd_seq_create_port(ms->seq, pinfo)) < 0) {
+		fprintf(stderr, "snd_seq_create_port: %s\n", snd_strerror(err));
+		oim__midi_seq_close(ms);
+		return;
+	}
+	ms->port = snd_seq_port_info_get_port(pinfo);
+
+	snd_seq_start_queue(ms->seq, ms->queue, NULL);
+	snd_seq_drain_output(ms->seq);
+	snd_seq_queue_status_t* status;
+	snd_seq_queue_status_alloca(&status);
+	if ((err = snd_seq_get_queue_status(ms->seq, ms->queue, status)) < 0) {
+		fprintf(stderr, "snd_seq_get_queue_status: %s\n", snd_strerror(err));
+		oim__midi_seq_close(ms);
+		return;
+	}
+	const snd_seq_real_time_t* rt = snd_seq_queue_status_get_real_time(status);
+	ms->t_offset = oim__now_ns() - ((int64_t)rt->tv_sec * 1000000000LL + rt->tv_nsec);
+
+	if (strcmp(source, "none") != 0) {
+		snd_seq_addr_t addr;
+		if ((err = snd_seq_parse_address(ms->seq, &addr, source)) < 0) {
+			fprintf(stderr, "midi seq source %s: %s\n", source, snd_strerror(err));
+		} else if ((err = snd_seq_connect_from(ms->seq, ms->port, addr.client, addr.port)) < 0) {
+			fprintf(stderr, "midi seq connect from %s: %s\n", source, snd_strerror(err));
+		}
+	}
+	fprintf(stderr, "midi seq open -> port %d\n", ms->port);
+
+	src->n_fds = snd_seq_poll_descriptors(ms->seq, src->fds, OIM_SOURCE_MAX_FDS, POLLIN);
+	oim_loop_add(loop, src);
+}
+
+/* returns 1 and the event as a channel message if it is one we care
+ * about */
+static int oim__midi_seq_msg(const snd_seq_event_t* ev, struct oim__midi_msg* msg)
+{
+	switch (ev->type) {
+	case SND_SEQ_EVENT_NOTEON:
+		msg->status = 0x90 | (ev->data.note.channel & 0x0f);
+		msg->d0 = ev->data.note.note & 0x7f;
+		msg->d1 = ev->data.note.velocity & 0x7f;
+		return 1;
+	case SND_SEQ_EVENT_NOTEOFF:
+		msg->status = 0x80 | (ev->data.note.channel & 0x0f);
+		msg->d0 = ev->data.note.note & 0x7f;
+		msg->d1 = ev->data.note.velocity & 0x7f;
+		return 1;
+	case SND_SEQ_EVENT_CONTROLLER:
+		msg->status = 0xb0 | (ev->data.control.channel & 0x0f);
+		msg->d0 = ev->data.control.param & 0x7f;
+		msg->d1 = ev->data.control.value & 0x7f;
+		return 1;
+	case SND_SEQ_EVENT_PITCHBEND: {
+		/* value is [-8192:8191] */
+		const int v = ev->data.control.value + 8192;
+		msg->status = 0xe0 | (ev->data.control.channel & 0x0f);
+		msg->d0 = v & 0x7f;
+		msg->d1 = (v >> 7) & 0x7f;
+		return 1;
+	}
+	}
+	return 0;
+}
+
+/* input capture. with --capture, everything read from the input devices
+ * is appended to a file: evdev events with their kernel timestamps, raw
+ * MIDI as it came in, and sequencer messages. the input side only
+ * pushes records into a preallocated ring; a thread of its own encodes
+ * and writes them, so the disk can never hold up input. if the ring
+ * fills up anyway, records are dropped, and counted.
+ *
+ * the file is "OIMC" and a u32le version, then records of
+ *   u8 kind, zigzag varint ns since the previous record
+ * followed by, for the evdev kinds,
+ *   varint type, varint code, zigzag varint value,
+ *   zigzag varint us since the previous evdev event's kernel timestamp
+ * for raw MIDI,
+ *   varint n, n bytes
+ * for sequencer messages, the status and both data bytes, and for the
+ * range of a pen or touch axis, written when its device opens,
+ *   varint code, zigzag varint min, zigzag varint max
+ * record times are when oim read the input (CLOCK_MONOTONIC), or a
+ * sequencer message's own timestamp; they're what replay goes by.
+ *
+ * capturing to an existing file checks its header, then appends a
+ * session record (kind and a 0 delta, nothing else) that starts the
+ * deltas over. replay plays the next session right after the last
+ * record of the one before, without the gap between them */
+
+enum oim__capture_kind {
+	OIM__CAPTURE_PEN = 1,
+	OIM__CAPTURE_TOUCH,
+	OIM__CAPTURE_PADBTNS,
+	OIM__CAPTURE_RAWMIDI,
+	OIM__CAPTURE_SEQ,
+	OIM__CAPTURE_SESSION,
+	OIM__CAPTURE_PEN_AXIS,
+	OIM__CAPTURE_TOUCH_AXIS,
+};
+
+#define OIM__CAPTURE_MAGIC "OIMC"
+#define OIM__CAPTURE_VERSION (1)
+#define OIM__CAPTURE_RING_SZ (1<<14)
+#define OIM__CAPTURE_MIDI_SZ (32)
+#define OIM__CAPTURE_MAX_RECORD_SZ (64)
+
+struct oim__capture_rec {
+	int64_t t;
+	uint8_t kind;
+	uint8_t n_midi;
+	uint8_t midi[OIM__CAPTURE_MIDI_SZ];
+	struct input_event ev;
+	int32_t axis_min, axis_max; // and ev.code, for the axis kinds
+};
+
+/* delta state; the same on both ends */
+struct oim__capture_codec {
+	int64_t t;
+	int64_t kt; // us
+};
+
+struct oim__capture {
+	FILE* f;
+	const char* path;
+	struct oim__capture_codec codec;
+	struct oim__spsc ring;
+	uint32_t n_dropped;
+	uint32_t wake;
+	uint32_t sleeping;
+};
+
+static uint8_t* oim__put_varint(uint8_t* p, uint64_t v)
+{
+	while (v >= 0x80) {
+		*(p++) = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	*(p++) = v;
+	return p;
+}
+
+static uint8_t* oim__put_zigzag(uint8_t* p, int64_t v)
+{
+	return oim__put_varint(p, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+static int oim__get_varint(FILE* f, uint64_t* v)
+{
+	*v = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		int c = getc(f);
+		if (c == EOF) return 0;
+		*v |= (uint64_t)(c & 0x7f) << shift;
+		if (!(c & 0x80)) return 1;
+	}
+	return 0;
+}
+
+static int oim__get_zigzag(FILE* f, int64_t* v)
+{
+	uint64_t u;
+	if (!oim__get_varint(f, &u)) return 0;
+	*v = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+	return 1;
+}
+
+static int oim__capture_encode(struct oim__capture_codec* c, const struct oim__capture_rec* rec, uint8_t* buf)
+{
+	uint8_t* p = buf;
+	*(p++) = rec->kind;
+	p = oim__put_zigzag(p, rec->t - c->t);
+	c->t = rec->t;
+	switch (rec->kind) {
+	case OIM__CAPTURE_PEN:
+	case OIM__CAPTURE_TOUCH:
+	case OIM__CAPTURE_PADBTNS: {
+		const int64_t kt = (int64_t)rec->ev.input_event_sec * 1000000LL + rec->ev.input_event_usec;
+		p = oim__put_varint(p, rec->ev.type);
+		p = oim__put_varint(p, rec->ev.code);
+		p = oim__put_zigzag(p, rec->ev.value);
+		p = oim__put_zigzag(p, kt - c->kt);
+		c->kt = kt;
+		break;
+	}
+	case OIM__CAPTURE_RAWMIDI:
+		p = oim__put_varint(p, rec->n_midi);
+		memcpy(p, rec->midi, rec->n_midi);
+		p += rec->n_midi;
+		break;
+	case OIM__CAPTURE_SEQ:
+		memcpy(p, rec->midi, 3);
+		p += 3;
+		break;
+	case OIM__CAPTURE_PEN_AXIS:
+	case OIM__CAPTURE_TOUCH_AXIS:
+		p = oim__put_varint(p, rec->ev.code);
+		p = oim__put_zigzag(p, rec->axis_min);
+		p = oim__put_zigzag(p, rec->axis_max);
+		break;
+	}
+	return p - buf;
+}
+
+/* returns 0 at the end of the file, or on a record that doesn't parse */
+static int oim__capture_decode(struct oim__capture_codec* c, FILE* f, struct oim__capture_rec* rec)
+{
+	memset(rec, 0, sizeof *rec);
+	int kind = getc(f);
+	int64_t dt;
+	if (kind == EOF || !oim__get_zigzag(f, &dt)) return 0;
+	rec->kind = kind;
+	rec->t = c->t + dt;
+	c->t = rec->t;
+
+	uint64_t u;
+	int64_t v, dkt;
+	switch (kind) {
+	case OIM__CAPTURE_PEN:
+	case OIM__CAPTURE_TOUCH:
+	case OIM__CAPTURE_PADBTNS:
+		if (!oim__get_varint(f, &u)) return 0;
+		rec->ev.type = u;
+		if (!oim__get_varint(f, &u)) return 0;
+		rec->ev.code = u;
+		if (!oim__get_zigzag(f, &v) || !oim__get_zigzag(f, &dkt)) return 0;
+		rec->ev.value = v;
+		c->kt += dkt;
+		rec->ev.input_event_sec = c->kt / 1000000LL;
+		rec->ev.input_event_usec = c->kt % 1000000LL;
+		return 1;
+	case OIM__CAPTURE_RAWMIDI:
+		if (!oim__get_varint(f, &u) || u > OIM__CAPTURE_MIDI_SZ) return 0;
+		rec->n_midi = u;
+		return fread(rec->midi, 1, rec->n_midi, f) == rec->n_midi;
+	case OIM__CAPTURE_SEQ:
+		rec->n_midi = 3;
+		return fread(rec->midi, 1, 3, f) == 3;
+	case OIM__CAPTURE_SESSION:
+		c->t = 0;
+		c->kt = 0;
+		return 1;
+	case OIM__CAPTURE_PEN_AXIS:
+	case OIM__CAPTURE_TOUCH_AXIS:
+		if (!oim__get_varint(f, &u)) return 0;
+		rec->ev.code = u;
+		if (!oim__get_zigzag(f, &v)) return 0;
+		rec->axis_min = v;
+		if (!oim__get_zigzag(f, &v)) return 0;
+		rec->axis_max = v;
+		return 1;
+	}
+	return 0;
+}
+
+static void oim__capture_push(struct oim__capture* c, const struct oim__capture_rec* rec)
+{
+	if (!oim__spsc_push(&c->ring, rec)) __atomic_add_fetch(&c->n_dropped, 1, __ATOMIC_RELAXED);
+}
+
+static void oim__capture_evdev(struct oim__capture* c, enum oim__capture_kind kind, const struct input_event* evs, int n, int64_t t)
+{
+	if (c == NULL) return;
+	struct oim__capture_rec rec;
+	memset(&rec, 0, sizeof rec);
+	rec.t = t;
+	rec.kind = kind;
+	for (int i = 0; i < n; i++) {
+		rec.ev = evs[i];
+		oim__capture_push(c, &rec);
+	}
+}
+
+static void oim__capture_midi(struct oim__capture* c, enum oim__capture_kind kind, const uint8_t* buf, int n, int64_t t)
+{
+	if (c == NULL) return;
+	struct oim__capture_rec rec;
+	memset(&rec, 0, sizeof rec);
+	rec.t = t;
+	rec.kind = kind;
+	for (int i = 0; i < n; i += OIM__CAPTURE_MIDI_SZ) {
+		rec.n_midi = (n - i) < OIM__CAPTURE_MIDI_SZ ? (n - i) : OIM__CAPTURE_MIDI_SZ;
+		memcpy(rec.midi, &buf[i], rec.n_midi);
+		oim__capture_push(c, &rec);
+	}
+}
+
+/* the ranges of a device's axes, as it opens */
+static void oim__capture_axes(struct oim__capture* c, enum oim__capture_kind kind, int fd, const int* codes, int n, int64_t t)
+{
+	if (c == NULL) return;
+	struct oim__capture_rec rec;
+	memset(&rec, 0, sizeof rec);
+	rec.t = t;
+	rec.kind = kind;
+	for (int i = 0; i < n; i++) {
+		rec.ev.code = codes[i];
+		oim_tablet_absinfo(fd, codes[i], &rec.axis_min, &rec.axis_max);
+		oim__capture_push(c, &rec);
+	}
+}
+
+/* wakes the writer, if it's asleep; called once per batch of input */
+static void oim__capture_kick(struct oim__capture* c)
+{
+	if (c == NULL) return;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&c->sleeping, __ATOMIC_RELAXED)) {
+		__atomic_add_fetch(&c->wake, 1, __ATOMIC_RELAXED);
+		oim__futex_wake(&c->wake);
+	}
+}
+
+static void* oim__capture_thread(void* usr)
+{
+	struct oim__capture* c = usr;
+	uint32_t n_dropped_seen = 0;
+	for (;;) {
+		const uint32_t seen = __atomic_load_n(&c->wake, __ATOMIC_ACQUIRE);
+		struct oim__capture_rec* rec;
+		while ((rec = oim__spsc_peek(&c->ring)) != NULL) {
+			uint8_t buf[OIM__CAPTURE_MAX_RECORD_SZ];
+			const int n = oim__capture_encode(&c->codec, rec, buf);
+			oim__spsc_drop(&c->ring);
+			if (fwrite(buf, n, 1, c->f) != 1) {
+				fprintf(stderr, "capture %s: %s\n", c->path, strerror(errno));
+			}
+		}
+		fflush(c->f);
+
+		const uint32_t n_dropped = __atomic_load_n(&c->n_dropped, __ATOMIC_RELAXED);
+		if (n_dropped != n_dropped_seen) {
+			fprintf(stderr, "capture %s: %u records dropped\n", c->path, n_dropped - n_dropped_seen);
+			n_dropped_seen = n_dropped;
+		}
+
+		/* the input side checks sleeping after pushing, and this side
+		 * checks the ring after setting it, so one of them sees the
+		 * other */
+		__atomic_store_n(&c->sleeping, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (oim__spsc_peek(&c->ring) == NULL) oim__futex_wait(&c->wake, seen);
+		__atomic_store_n(&c->sleeping, 0, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+static void oim__capture_check_header(FILE* f, const char* what, const char* path)
+{
+	uint8_t h[8];
+	if (fread(h, sizeof h, 1, f) != 1 || memcmp(h, OIM__CAPTURE_MAGIC, 4) != 0) {
+		fprintf(stderr, "%s %s: not a capture file\n", what, path);
+		exit(EXIT_FAILURE);
+	}
+	const uint32_t version = h[4] | (h[5] << 8) | (h[6] << 16) | ((uint32_t)h[7] << 24);
+	if (version != OIM__CAPTURE_VERSION) {
+		fprintf(stderr, "%s %s: version %u; expected %d\n", what, path, version, OIM__CAPTURE_VERSION);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static struct oim__capture* oim__capture_start(const char* path)
+{
+	struct oim__capture* c = calloc(1, sizeof *c);
+	assert(c != NULL);
+	c->path = path;
+	c->f = fopen(path, "a+b");
+	if (c->f == NULL || fseek(c->f, 0, SEEK_END) != 0) {
+		fprintf(stderr, "capture %s: %s\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	if (ftell(c->f) == 0) {
+		uint8_t h[8];
+		memcpy(h, OIM__CAPTURE_MAGIC, 4);
+		oim__put_u32le(&h[4], OIM__CAPTURE_VERSION);
+		fwrite(h, sizeof h, 1, c->f);
+	} else {
+		rewind(c->f);
+		oim__capture_check_header(c->f, "capture", path);
+		fseek(c->f, 0, SEEK_END);
+		const uint8_t session[2] = { OIM__CAPTURE_SESSION, 0 };
+		fwrite(session, sizeof session, 1, c->f);
+	}
+	oim__spsc_init(&c->ring, sizeof(struct oim__capture_rec), OIM__CAPTURE_RING_SZ);
+
+	pthread_t thread;
+	int err = pthread_create(&thread, NULL, oim__capture_thread, c);
+	if (err != 0) {
+		fprintf(stderr, "pthread_create: %s\n", strerror(err));
+		exit(EXIT_FAILURE);
+	}
+	fprintf(stderr, "capturing input to %s\n", path);
+	return c;
+}
+
+/* input devices; the producer side of the input queue */
+
+struct oim__inputs {
+	int fd_pen;
+	int fd_touch;
+	int fd_padbtns;
+	snd_rawmidi_t* rawmidi;
+	struct oim__midi_parser midi_parser;
+	struct oim__midi_seq midi_seq;
+
+	struct oim_input state;
+	struct oim_pen_frame pen;
+	struct oim_touch_frame touch;
+	struct oim__input_queue* queue;
+	struct oim__capture* capture;
+
+	struct oim_loop* loop;
+	struct oim_source src_pen;
+	struct oim_source src_touch;
+	struct oim_source src_padbtns;
+	struct oim_source src_rawmidi;
+	struct oim_source src_seq;
+	uint32_t hotplug_seen;
+};
+
+static void oim__inputs_init(struct oim__inputs* in, struct oim__input_queue* queue, struct oim_loop* loop)
+{
+	memset(in, 0, sizeof *in);
+	in->fd_pen = -1;
+	in->fd_touch = -1;
+	in->fd_padbtns = -1;
+	in->queue = queue;
+	in->loop = loop;
+	if (loop != NULL) in->hotplug_seen = loop->hotplug - 1;
+	oim_pen_frame_init(&in->pen, -1);
+	oim_touch_frame_init(&in->touch, -1);
+}
+
+/* opens whichever devices are missing, but only once something has
+ * appeared in /dev since the last try */
+static void oim__inputs_open(struct oim__inputs* in)
+{
+	if (in->hotplug_seen == in->loop->hotplug) return;
+	in->hotplug_seen = in->loop->hotplug;
+
+	/* the axes' ranges are read as a device opens, and captured, so
+	 * that replay scales them the same way */
+	if (in->fd_pen == -1) {
+		oim_loop_open_fd(in->loop, &in->src_pen, &in->fd_pen, "/dev/tablet_pen");
+		if (in->fd_pen != -1) {
+			oim_pen_frame_init(&in->pen, in->fd_pen);
+			oim__capture_axes(in->capture, OIM__CAPTURE_PEN_AXIS, in->fd_pen, oim_pen_axes, OIM_PEN_N_AXES, oim__now_ns());
+		}
+	}
+	if (in->fd_touch == -1) {
+		oim_loop_open_fd(in->loop, &in->src_touch, &in->fd_touch, "/dev/tablet_touch");
+		if (in->fd_touch != -1) {
+			oim_touch_frame_init(&in->touch, in->fd_touch);
+			oim__capture_axes(in->capture, OIM__CAPTURE_TOUCH_AXIS, in->fd_touch, oim_touch_axes, OIM_TOUCH_N_AXES, oim__now_ns());
+		}
+	}
+	oim_loop_open_fd(in->loop, &in->src_padbtns, &in->fd_padbtns, "/dev/tablet_padbtns");
+	oim__open_rawmidi(in->loop, &in->src_rawmidi, &in->rawmidi);
+	oim__open_midi_seq(in->loop, &in->src_seq, &in->midi_seq);
+}
+
+static void oim__inputs_close_seq(struct oim__inputs* in)
+{
+	oim_loop_remove(in->loop, &in->src_seq);
+	oim__midi_seq_close(&in->midi_seq);
+}
+
+/* returns 1 if the message changed a continuous control */
+static int oim__inputs_midi(struct oim__inputs* in, const struct oim__midi_msg* msg, int64_t t)
+{
+	/* notes on every channel go through, for the engine to route to
+	 * layers; the controls are only taken from --midi-channel */
+	const unsigned int channel = oim__config.midi_channel;
+	const int ours = channel == 0 || (msg->status & 0x0f) == (channel - 1);
+
+	struct oim_input* input = &in->state;
+	const uint8_t cmd = msg->status & 0xf0;
+	if (cmd == 0x90 || cmd == 0x80) {
+		struct oim_note_event ev;
+		memset(&ev, 0, sizeof ev);
+		ev.note = msg->d0;
+		ev.channel = msg->status & 0x0f;
+		/* note on with velocity 0 is note off */
+		ev.velocity = cmd == 0x90 ? ((float)msg->d1 / 127.0f) : 0;
+		oim__input_queue_push_note(in->queue, &ev, t);
+	} else if (!ours) {
+		return 0;
+	} else if (cmd == 0xb0) {
+		input->midi_cc[msg->d0] = (float)msg->d1 / 127.0f;
+		return 1;
+	} else if (cmd == 0xe0) {
+		const int v = ((int)msg->d1 << 7) | msg->d0;
+		input->midi_pitch_bend = (float)(v - 8192) / 8192.0f;
+		return 1;
+	}
+	return 0;
+}
+
+/* these take input whether it was just read, or is being replayed; all
+ * return 1 if a continuous control changed. fd is only for reading the
+ * pen's axes back after SYN_DROPPED, and is -1 on replay */
+
+static int oim__inputs_pen(struct oim__inputs* in, int fd, const struct input_event* ev)
+{
+	#if DEBUG
+	printf("PEN\t0x%x 0x%x 0x%x\n", ev->type, ev->code, ev->value);
+	#endif
+	if (!oim_pen_frame_event(&in->pen, fd, ev)) return 0;
+	in->state.pen_x = in->pen.x;
+	in->state.pen_y = in->pen.y;
+	in->state.pen_pressure = in->pen.pressure;
+	return 1;
+}
+
+static int oim__inputs_touch(struct oim__inputs* in, int fd, const struct input_event* ev)
+{
+	#if DEBUG
+	printf("TOUCH\t0x%x 0x%x 0x%x\n", ev->type, ev->code, ev->value);
+	#endif
+	if (!oim_touch_frame_event(&in->touch, fd, ev)) return 0;
+	oim__touch_frame_apply(&in->touch, &in->state);
+	return 1;
+}
+
+static int oim__inputs_rawmidi(struct oim__inputs* in, const uint8_t* buf, int n, int64_t t)
+{
+	#if DEBUG
+	printf("MIDI");
+	for (int i = 0; i < n; i++) printf(" %02X", buf[i]);
+	printf("\n");
+	#endif
+
+	int changed = 0;
+	struct oim__midi_msg msg;
+	for (int i = 0; i < n; i++) {
+		if (oim__midi_parse(&in->midi_parser, buf[i], &msg)) {
+			changed |= oim__inputs_midi(in, &msg, t);
+		}
+	}
+	return changed;
+}
+
+static void oim__inputs_handle(struct oim__inputs* in)
+{
+	int err;
+	struct oim_input* input = &in->state;
+	int changed = 0;
+
+	{
+		struct input_event evs[OIM__MAX_INPUT_EVENTS];
+		int n;
+		const int64_t t = oim__now_ns();
+
+		const int fd_pen = in->fd_pen;
+		n = oim__handle_input_events(in->loop, &in->src_pen, &in->fd_pen, evs, OIM__MAX_INPUT_EVENTS);
+		oim__capture_evdev(in->capture, OIM__CAPTURE_PEN, evs, n, t);
+		for (int j = 0; j < n; j++) {
+			changed |= oim__inputs_pen(in, fd_pen, &evs[j]);
+		}
+
+		const int fd_touch = in->fd_touch;
+		n = oim__handle_input_events(in->loop, &in->src_touch, &in->fd_touch, evs, OIM__MAX_INPUT_EVENTS);
+		oim__capture_evdev(in->capture, OIM__CAPTURE_TOUCH, evs, n, t);
+		for (int j = 0; j < n; j++) {
+			changed |= oim__inputs_touch(in, fd_touch, &evs[j]);
+		}
+		if (fd_touch != -1 && in->fd_touch == -1) {
+			oim_touch_frame_release(&in->touch);
+			oim__touch_frame_apply(&in->touch, input);
+			changed = 1;
+		}
+
+		n = oim__handle_input_events(in->loop, &in->src_padbtns, &in->fd_padbtns, evs, OIM__MAX_INPUT_EVENTS);
+		oim__capture_evdev(in->capture, OIM__CAPTURE_PADBTNS, evs, n, t);
+		for (int j = 0; j < n; j++) {
+			#if DEBUG
+			printf("PADBTNS\t0x%x 0x%x 0x%x\n", evs[j].type, evs[j].code, evs[j].value);
+			#endif
+		}
+	}
+
+	if (in->rawmidi != NULL) {
+		unsigned short revents;
+		err = snd_rawmidi_poll_descriptors_revents(in->rawmidi, in->src_rawmidi.fds, in->src_rawmidi.n_fds, &revents);
+		if (err < 0) {
+			fprintf(stderr, "midi revents error: %s\n", snd_strerror(err));
+			oim__close_rawmidi(in->loop, &in->src_rawmidi, &in->rawmidi);
+		} else if (revents & (POLLERR | POLLHUP)) {
+			fprintf(stderr, "midi HUP\n");
+			oim__close_rawmidi(in->loop, &in->src_rawmidi, &in->rawmidi);
+		} else if (revents & POLLIN) {
+			/* read until drained; a message may end up split
+			 * across reads, which the parser deals with */
+			for (;;) {
+				uint8_t buf[256];
+				int n_read = snd_rawmidi_read(in->rawmidi, buf, sizeof buf);
+				int64_t t = oim__now_ns();
+				if (n_read == -EAGAIN) {
+					break;
+				} else if (n_read < 0) {
+					fprintf(stderr, "midi read error: %s\n", snd_strerror(n_read));
+					oim__close_rawmidi(in->loop, &in->src_rawmidi, &in->rawmidi);
+					break;
+				}
+
+				oim__capture_midi(in->capture, OIM__CAPTURE_RAWMIDI, buf, n_read, t);
+				changed |= oim__inputs_rawmidi(in, buf, n_read, t);
+				if (n_read < (int)sizeof buf) break;
+			}
+		}
+	}
+
+	if (in->midi_seq.seq != NULL) {
+		struct oim__midi_seq* ms = &in->midi_seq;
+		unsigned short revents;
+		err = snd_seq_poll_descriptors_revents(ms->seq, in->src_seq.fds, in->src_seq.n_fds, &revents);
+		if (err < 0) {
+			fprintf(stderr, "midi seq revents error: %s\n", snd_strerror(err));
+			oim__inputs_close_seq(in);
+		} else if (revents & (POLLERR | POLLHUP)) {
+			fprintf(stderr, "midi seq HUP\n");
+			oim__inputs_close_seq(in);
+		} else if (revents & POLLIN) {
+			snd_seq_event_t* ev;
+			/* -ENOSPC means events were lost to an overrun; the
+			 * ones still queued are fine */
+			while ((err = snd_seq_event_input(ms->seq, &ev)) >= 0 || err == -ENOSPC) {
+				if (err < 0) {
+					fprintf(stderr, "midi seq overrun\n");
+					continue;
+				}
+				const int64_t now = oim__now_ns();
+				int64_t t = now;
+				if ((ev->flags & SND_SEQ_TIME_STAMP_MASK) == SND_SEQ_TIME_STAMP_REAL) {
+					t = ms->t_offset + (int64_t)ev->time.time.tv_sec * 1000000000LL + ev->time.time.tv_nsec;
+					if (t > now) t = now;
+				}
+				struct oim__midi_msg msg;
+				if (oim__midi_seq_msg(ev, &msg)) {
+					const uint8_t bytes[3] = { msg.status, msg.d0, msg.d1 };
+					oim__capture_midi(in->capture, OIM__CAPTURE_SEQ, bytes, 3, t);
+					changed |= oim__inputs_midi(in, &msg, t);
+				}
+			}
+			if (err != -EAGAIN) {
+				fprintf(stderr, "midi seq read error: %s\n", snd_strerror(err));
+				oim__inputs_close_seq(in);
+			}
+		}
+	}
+
+	if (changed) oim__input_queue_publish(in->queue, input);
+	oim__capture_kick(in->capture);
+}
+
+static void* oim__input_thread(void* usr)
+{
+	struct oim__inputs* in = usr;
+	for (;;) {
+		oim__inputs_open(in);
+
+		int err = oim_loop_wait(in->loop, -1);
+		if (err == 0) {
+			continue;
+		} else if (err == -1) {
+			perror("epoll_wait");
+			sleep(1);
+			continue;
+		}
+
+		oim__inputs_handle(in);
+	}
+	return NULL;
+}
+
+/* replay of a --capture file, through the same input handling as live
+ * input. live (--replay), it stands in for the input devices, and plays
+ * the records at their original timing, or --replay-speed times faster,
+ * or as fast as it can with a speed of 0. offline, records go by their
+ * time relative to the first one, so a render is the same every time */
+
+struct oim__replay {
+	FILE* f;
+	const char* path;
+	struct oim__capture_codec codec;
+	struct oim__capture_rec rec; // the next record
+	int have;
+	int64_t t0; // time of the first record, moved along at each session
+	struct oim__inputs in;
+};
+
+static void oim__replay_advance(struct oim__replay* rp)
+{
+	const int64_t t_last = rp->rec.t;
+	int session = 0;
+	while ((rp->have = oim__capture_decode(&rp->codec, rp->f, &rp->rec)) && rp->rec.kind == OIM__CAPTURE_SESSION) session = 1;
+	if (!rp->have && !feof(rp->f)) fprintf(stderr, "replay %s: bad record\n", rp->path);
+	if (rp->have && session) rp->t0 += rp->rec.t - t_last;
+}
+
+static void oim__replay_open(struct oim__replay* rp, const char* path, struct oim__input_queue* queue)
+{
+	memset(rp, 0, sizeof *rp);
+	rp->path = path;
+	rp->f = fopen(path, "rb");
+	if (rp->f == NULL) {
+		fprintf(stderr, "replay %s: %s\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	oim__capture_check_header(rp->f, "replay", path);
+	oim__inputs_init(&rp->in, queue, NULL);
+	oim__replay_advance(rp);
+	rp->t0 = rp->rec.t;
+}
+
+/* applies the next record as if it had been read at time t */
+static int oim__replay_apply(struct oim__replay* rp, int64_t t)
+{
+	const struct oim__capture_rec* rec = &rp->rec;
+	struct oim__midi_msg msg;
+	switch (rec->kind) {
+	case OIM__CAPTURE_PEN:
+		return oim__inputs_pen(&rp->in, -1, &rec->ev);
+	case OIM__CAPTURE_TOUCH:
+		return oim__inputs_touch(&rp->in, -1, &rec->ev);
+	case OIM__CAPTURE_RAWMIDI:
+		return oim__inputs_rawmidi(&rp->in, rec->midi, rec->n_midi, t);
+	case OIM__CAPTURE_SEQ:
+		msg.status = rec->midi[0];
+		msg.d0 = rec->midi[1];
+		msg.d1 = rec->midi[2];
+		return oim__inputs_midi(&rp->in, &msg, t);
+	case OIM__CAPTURE_PEN_AXIS:
+		oim_pen_frame_axis(&rp->in.pen, rec->ev.code, rec->axis_min, rec->axis_max);
+		return 0;
+	case OIM__CAPTURE_TOUCH_AXIS:
+		oim_touch_frame_axis(&rp->in.touch, rec->ev.code, rec->axis_min, rec->axis_max);
+		return 0;
+	}
+	return 0;
+}
+
+static void* oim__replay_thread(void* usr)
+{
+	struct oim__replay* rp = usr;
+	const double speed = oim__config.replay_speed;
+	const int64_t t_start = oim__now_ns();
+	fprintf(stderr, "replaying %s at %gx\n", rp->path, speed);
+	while (rp->have) {
+		int64_t t = oim__now_ns();
+		if (speed > 0) {
+			const int64_t t_rec = t_start + (int64_t)((double)(rp->rec.t - rp->t0) / speed);
+			if (t_rec > t) {
+				struct timespec ts;
+				ts.tv_sec = t_rec / 1000000000LL;
+				ts.tv_nsec = t_rec % 1000000000LL;
+				while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+				t = t_rec;
+			}
+		}
+		if (oim__replay_apply(rp, t)) oim__input_queue_publish(rp->in.queue, &rp->in.state);
+		oim__replay_advance(rp);
+	}
+	fprintf(stderr, "replay %s: done\n", rp->path);
+	return NULL;
+}
+
+struct oim__replay_offline {
+	struct oim__replay replay;
+	struct oim__input_queue queue;
+};
+
+static struct oim__replay_offline* oim__replay_offline_open(const char* path)
+{
+	struct oim__replay_offline* r = calloc(1, sizeof *r);
+	assert(r != NULL);
+	oim__input_queue_init(&r->queue);
+	oim__replay_open(&r->replay, path, &r->queue);
+	return r;
+}
+
+/* fills in input for the block of n_frames output frames starting at
+ * output frame frame */
+static void oim__replay_offline_block(struct oim__replay_offline* r, struct oim_input* input, uint64_t frame, uint32_t n_frames, unsigned int sample_rate, int oversample_ratio)
+{
+	struct oim__replay* rp = &r->replay;
+	const double frame_ns = 1e9 / (double)sample_rate;
+	const int64_t t_block = rp->t0 + (int64_t)((double)frame * frame_ns);
+	const int64_t t_end = rp->t0 + (int64_t)((double)(frame + n_frames) * frame_ns);
+	int changed = 0;
+	while (rp->have && rp->rec.t < t_end) {
+		changed |= oim__replay_apply(rp, rp->rec.t);
+		oim__replay_advance(rp);
+	}
+	if (changed) oim__input_queue_publish(&r->queue, &rp->in.state);
+	oim__input_queue_consume(&r->queue, input, t_block, frame_ns / oversample_ratio, n_frames * oversample_ratio);
+}
+
+/* audio thread stats. the audio thread is the only writer, and only
+ * ever does relaxed loads and stores of its own counters, so it never
+ * waits on a reader. readers (the stats thread, or other processes
+ * when the struct lives in a shm object) may see a period half
+ * accounted for, which is fine for stats.
+ *
+ * histograms have a bucket per power of two; bucket i counts values v
+ * with 2^i <= v < 2^(i+1), times being in nanoseconds */
+
+#define OIM__STATS_MAGIC (0x6f696d73) // "oims"
+#define OIM__STATS_VERSION (1)
+#define OIM__STATS_N_BUCKETS (32)
+#define OIM__STATS_N_FILL_BUCKETS (16)
+/* a period whose render took more than this part of its own duration
+ * counts as slow */
+#define OIM__STATS_SLOW_FRACTION (0.5)
+
+enum oim__stats_stage {
+	OIM__STATS_PROCESS = 0,
+	OIM__STATS_DECIMATE,
+	OIM__STATS_WRITE,
+	OIM__STATS_PERIOD,
+	OIM__STATS_N_STAGES
+};
+
+static const char* oim__stats_stage_names[] = {
+	"process",
+	"decimate",
+	"write",
+	"period",
+};
+
+struct oim__stats {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t sample_rate;
+	uint64_t period_size;
+	uint64_t buffer_size;
+
+	uint64_t n_periods;
+	uint64_t n_xruns;
+	uint64_t n_errors; // other errors that needed recovering from
+	uint64_t n_opens;
+	uint64_t n_slow;
+	uint64_t n_subnormal;
+
+	int64_t delay; // frames queued in the device at the start of the last period
+	uint64_t fill[OIM__STATS_N_FILL_BUCKETS]; // delay/buffer_size, at the start of each period
+	uint64_t hist[OIM__STATS_N_STAGES][OIM__STATS_N_BUCKETS];
+};
+
+static void oim__stats_add(uint64_t* p, uint64_t n)
+{
+	__atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+static void oim__stats_set(uint64_t* p, uint64_t v)
+{
+	__atomic_store_n(p, v, __ATOMIC_RELAXED);
+}
+
+static uint64_t oim__stats_get(const uint64_t* p)
+{
+	return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static int oim__stats_bucket(int64_t v)
+{
+	if (v <= 1) return 0;
+	int i = 63 - __builtin_clzll((uint64_t)v);
+	return i < OIM__STATS_N_BUCKETS ? i : (OIM__STATS_N_BUCKETS - 1);
+}
+
+static void oim__stats_time(struct oim__stats* st, enum oim__stats_stage stage, int64_t ns)
+{
+	oim__stats_add(&st->hist[stage][oim__stats_bucket(ns)], 1);
+}
+
+static void oim__stats_fill(struct oim__stats* st, int64_t delay, uint64_t buffer_size)
+{
+	__atomic_store_n(&st->delay, delay, __ATOMIC_RELAXED);
+	int i = 0;
+	if (delay > 0 && buffer_size > 0) {
+		i = (delay * OIM__STATS_N_FILL_BUCKETS) / (int64_t)buffer_size;
+		if (i >= OIM__STATS_N_FILL_BUCKETS) i = OIM__STATS_N_FILL_BUCKETS - 1;
+	}
+	oim__stats_add(&st->fill[i], 1);
+}
+
+/* the stats live in a shm object if --stats-shm names one, so that other
+ * processes can map it and read along; otherwise in private memory */
+static struct oim__stats* oim__stats_create()
+{
+	struct oim__stats* st = NULL;
+	const char* name = oim__config.stats_shm;
+	if (name != NULL) {
+		int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+		if (fd == -1) {
+			fprintf(stderr, "shm_open %s: %s\n", name, strerror(errno));
+		} else {
+			if (ftruncate(fd, sizeof *st) == -1) {
+				fprintf(stderr, "ftruncate %s: %s\n", name, strerror(errno));
+			} else {
+				void* p = mmap(NULL, sizeof *st, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+				if (p == MAP_FAILED) {
+					fprintf(stderr, "mmap %s: %s\n", name, strerror(errno));
+				} else {
+					st = p;
+					fprintf(stderr, "publishing stats in shm %s (%zu bytes, version %d)\n", name, sizeof *st, OIM__STATS_VERSION);
+				}
+			}
+			close(fd);
+		}
+	}
+	if (st == NULL) {
+		st = calloc(1, sizeof *st);
+		assert(st != NULL);
+	}
+	memset(st, 0, sizeof *st);
+	st->version = OIM__STATS_VERSION;
+	__atomic_store_n(&st->magic, OIM__STATS_MAGIC, __ATOMIC_RELEASE);
+	return st;
+}
+
+/* upper bound of the bucket holding the q'th quantile of what was
+ * counted between two snapshots of a histogram */
+static double oim__stats_quantile(const uint64_t* now, const uint64_t* then, int n_buckets, double q)
+{
+	uint64_t total = 0;
+	for (int i = 0; i < n_buckets; i++) total += now[i] - then[i];
+	if (total == 0) return 0;
+	uint64_t target = (uint64_t)ceil(q * (double)total);
+	if (target < 1) target = 1;
+	uint64_t acc = 0;
+	for (int i = 0; i < n_buckets; i++) {
+		acc += now[i] - then[i];
+		if (acc >= target) return (double)((uint64_t)2 << i);
+	}
+	return (double)((uint64_t)2 << (n_buckets - 1));
+}
+
+static void oim__stats_snapshot(const struct oim__stats* st, struct oim__stats* out)
+{
+	const uint64_t* src = (const uint64_t*)&st->sample_rate;
+	uint64_t* dst = (uint64_t*)&out->sample_rate;
+	const int n = (sizeof *st - offsetof(struct oim__stats, sample_rate)) / sizeof(uint64_t);
+	for (int i = 0; i < n; i++) dst[i] = oim__stats_get(&src[i]);
+}
+
+/* prints a line per interval with what happened during it; stage times
+ * are median/p99/max, rounded up to the bucket bound. runs on a thread
+ * of its own so the audio thread never waits on stderr */
+static void* oim__stats_thread(void* usr)
+{
+	const struct oim__stats* st = usr;
+	struct oim__stats then, now;
+	memset(&then, 0, sizeof then);
+	for (;;) {
+		sleep(oim__config.stats_interval);
+		oim__stats_snapshot(st, &now);
+
+		const double period_us = now.sample_rate > 0 ? (1e6 * (double)now.period_size / (double)now.sample_rate) : 0;
+		fprintf(stderr, "stats: periods=%llu period=%lluf/%.0fus buffer=%lluf",
+			(unsigned long long)(now.n_periods - then.n_periods),
+			(unsigned long long)now.period_size,
+			period_us,
+			(unsigned long long)now.buffer_size);
+		for (int i = 0; i < OIM__STATS_N_STAGES; i++) {
+			fprintf(stderr, " %s<=%.0f/%.0f/%.0fus",
+				oim__stats_stage_names[i],
+				oim__stats_quantile(now.hist[i], then.hist[i], OIM__STATS_N_BUCKETS, 0.5) * 1e-3,
+				oim__stats_quantile(now.hist[i], then.hist[i], OIM__STATS_N_BUCKETS, 0.99) * 1e-3,
+				oim__stats_quantile(now.hist[i], then.hist[i], OIM__STATS_N_BUCKETS, 1.0) * 1e-3);
+		}
+		/* the emptiest the device buffer got, by the lower bound of
+		 * its bucket */
+		int fill_min = 0;
+		while (fill_min < (OIM__STATS_N_FILL_BUCKETS - 1) && now.fill[fill_min] == then.fill[fill_min]) fill_min++;
+		fprintf(stderr, " fill>=%d%% xruns=%llu errors=%llu opens=%llu slow=%llu subnormal=%llu\n",
+			(fill_min * 100) / OIM__STATS_N_FILL_BUCKETS,
+			(unsigned long long)(now.n_xruns - then.n_xruns),
+			(unsigned long long)(now.n_errors - then.n_errors),
+			(unsigned long long)(now.n_opens - then.n_opens),
+			(unsigned long long)(now.n_slow - then.n_slow),
+			(unsigned long long)(now.n_subnormal - then.n_subnormal));
+		then = now;
+	}
+	return NULL;
+}
+
+/* adaptive latency; starts at the smallest period size and doubles it on
+ * every xrun. after a while without xruns it tries halving it again, and
+ * every xrun doubles how long that while is, so a setting that keeps
+ * failing is retried less and less often. the learned size survives the
+ * device being closed and reopened */
+
+struct oim__adaptive {
+	snd_pcm_uframes_t period_size;
+	double shrink_wait;
+	double t_last_change;
+	int reopen;
+};
+
+#define OIM__ADAPTIVE_SHRINK_WAIT (30.0)
+
+static void oim__adaptive_init(struct oim__adaptive* ad)
+{
+	memset(ad, 0, sizeof *ad);
+	ad->period_size = oim__config.adaptive_min;
+	ad->shrink_wait = OIM__ADAPTIVE_SHRINK_WAIT;
+	ad->t_last_change = oim__now();
+}
+
+/* the largest period size oim asks a device for; --adaptive doubles
+ * its way up from --adaptive-min */
+static int oim__max_period_size()
+{
+	snd_pcm_uframes_t max = oim__config.period_size;
+	if (!oim__config.adaptive) return max;
+	snd_pcm_uframes_t p = oim__config.adaptive_min;
+	while (p < oim__config.adaptive_max) p *= 2;
+	return p > max ? p : max;
+}
+
+static void oim__adaptive_xrun(struct oim__adaptive* ad)
+{
+	if (!oim__config.adaptive) return;
+	ad->shrink_wait *= 2.0;
+	ad->t_last_change = oim__now();
+	if (ad->period_size < oim__config.adaptive_max) {
+		ad->period_size *= 2;
+		ad->reopen = 1;
+		fprintf(stderr, "adaptive: xrun; growing period size to %lu\n", ad->period_size);
+	}
+}
+
+static void oim__adaptive_tick(struct oim__adaptive* ad)
+{
+	if (!oim__config.adaptive) return;
+	const double t = oim__now();
+	if ((t - ad->t_last_change) < ad->shrink_wait) return;
+	ad->t_last_change = t;
+	if ((ad->period_size / 2) >= oim__config.adaptive_min) {
+		ad->period_size /= 2;
+		ad->reopen = 1;
+		fprintf(stderr, "adaptive: no xruns for %.0fs; trying period size %lu\n", ad->shrink_wait, ad->period_size);
+	}
+}
+
+/* --reload. the loader thread loads every new version of the object
+ * into pending, and the audio thread swaps it into the main layer at the
+ * start of a period, when no layer is rendering, then bumps n_swapped.
+ * the loader waits for that before unloading the version it replaced,
+ * so nothing is ever unloaded from under the audio thread, and nothing
+ * that's loading ever holds it up */
+
+/* what the host hands an object as it's loaded, before anything in it
+ * runs: its configuration, as resolved from the environment and the
+ * command line, which the object couldn't see, and its wavetables, so
+ * the object doesn't build (and, once it's unloaded, leak) a copy of
+ * its own on every load. the sizes catch objects built against another
+ * oim.h */
+struct oim__host {
+	uint32_t size;
+	uint32_t config_size;
+	const struct oim__config* config;
+	const float* wavetables;
+};
+
+struct oim__plugin {
+	void* handle; // NULL for the function oim_run was given
+	oim_process_fn process_fn;
+	oim_planar_fn planar_fn;
+	void* usr;
+	void (*retire)(void* usr);
+};
+
+struct oim__reload {
+	const char* path;
+	struct oim__layer* layer;
+	int planar;
+	struct oim__plugin current; // what's in the layer; the loader's
+	struct oim__plugin next;
+	struct oim__plugin* pending; // &next, until the audio thread takes it
+	uint32_t n_swapped;
+	void* run_usr; // the state oim_run was given, which is never retired
+	int oversample_ratio;
+};
+
+/* dlopen hands back the object it has already for a path it's seen,
+ * and an object overwritten in place while it's loaded can crash, so
+ * every version is loaded from a copy of its own, unlinked straight
+ * away */
+static void* oim__reload_dlopen(const char* path)
+{
+	char tmp[PATH_MAX];
+	snprintf(tmp, sizeof tmp, "%s.XXXXXX", path);
+	int out = mkstemp(tmp);
+	if (out == -1) {
+		fprintf(stderr, "reload %s: %s\n", tmp, strerror(errno));
+		return NULL;
+	}
+	int in = open(path, O_RDONLY | O_CLOEXEC);
+	int ok = in != -1;
+	char buf[1<<16];
+	ssize_t n = 0;
+	while (ok && (n = read(in, buf, sizeof buf)) > 0) ok = write(out, buf, n) == n;
+	ok = ok && n == 0;
+	if (!ok) fprintf(stderr, "reload %s: %s\n", path, strerror(errno));
+	if (in != -1) close(in);
+	close(out);
+
+	void* handle = NULL;
+	if (ok) {
+		handle = dlopen(tmp, RTLD_NOW | RTLD_LOCAL);
+		if (handle == NULL) fprintf(stderr, "reload %s: %s\n", path, dlerror());
+	}
+	unlink(tmp);
+	return handle;
+}
+
+/* locks an object's segments, so that the first period after the swap
+ * doesn't fault its code and data in on the audio thread. relro is
+ * read only by now, so if mlock fails, it's only read to fault it in */
+static int oim__reload_lock_object(struct dl_phdr_info* info, size_t size, void* usr)
+{
+	const struct link_map* lm = usr;
+	if (info->dlpi_addr != lm->l_addr || strcmp(info->dlpi_name, lm->l_name) != 0) return 0;
+	uintptr_t relro = 0, relro_end = 0;
+	for (int i = 0; i < info->dlpi_phnum; i++) {
+		const ElfW(Phdr)* ph = &info->dlpi_phdr[i];
+		if (ph->p_type != PT_GNU_RELRO) continue;
+		relro = info->dlpi_addr + ph->p_vaddr;
+		relro_end = relro + ph->p_memsz;
+	}
+	for (int i = 0; i < info->dlpi_phnum; i++) {
+		const ElfW(Phdr)* ph = &info->dlpi_phdr[i];
+		if (ph->p_type != PT_LOAD) continue;
+		uintptr_t a = info->dlpi_addr + ph->p_vaddr;
+		const uintptr_t end = a + ph->p_memsz;
+		if (!(ph->p_flags & PF_W)) {
+			oim__lock((const void*)a, end - a, 0, "reloaded object");
+			continue;
+		}
+		if (a >= relro && a < relro_end) {
+			const uintptr_t ro_end = relro_end < end ? relro_end : end;
+			oim__lock((const void*)a, ro_end - a, 0, "reloaded object relro");
+			a = ro_end;
+		}
+		if (a < end) oim__lock((const void*)a, end - a, 1, "reloaded object data");
+	}
+	return 1;
+}
+
+#define OIM__RELOAD_WARM_FRAMES (16)
+
+/* loads the object into r->next; returns 0 on success */
+static int oim__reload_load(struct oim__reload* r)
+{
+	void* handle = oim__reload_dlopen(r->path);
+	if (handle == NULL) return -1;
+
+	struct oim__host host;
+	memset(&host, 0, sizeof host);
+	host.size = sizeof host;
+	host.config_size = sizeof oim__config;
+	host.config = &oim__config;
+	host.wavetables = oim__wavetables;
+	int (*attach)(const struct oim__host*) = (int (*)(const struct oim__host*))dlsym(handle, "oim_plugin_attach");
+	if (attach == NULL || attach(&host) != 0) {
+		fprintf(stderr, "reload %s: not built with -DOIM_PLUGIN against this oim.h\n", r->path);
+		dlclose(handle);
+		return -1;
+	}
+
+	struct oim__plugin* p = &r->next;
+	memset(p, 0, sizeof *p);
+	p->handle = handle;
+	const char* name = r->planar ? "oim_process_planar" : "oim_process";
+	void* fn = dlsym(handle, name);
+	if (fn == NULL) {
+		fprintf(stderr, "reload %s: no %s\n", r->path, name);
+		dlclose(handle);
+		return -1;
+	}
+	if (r->planar) {
+		p->planar_fn = (oim_planar_fn)fn;
+	} else {
+		p->process_fn = (oim_process_fn)fn;
+	}
+
+	void* (*migrate)(void*) = (void* (*)(void*))dlsym(handle, "oim_reload");
+	p->usr = migrate != NULL ? migrate(r->current.usr) : r->current.usr;
+	p->retire = (void (*)(void*))dlsym(handle, "oim_retire");
+
+	struct link_map* lm;
+	if (dlinfo(handle, RTLD_DI_LINKMAP, &lm) == 0) dl_iterate_phdr(oim__reload_lock_object, lm);
+
+	/* and a few frames rendered here, for anything the first call
+	 * sets up. only with a state of its own, as the one in use is the
+	 * audio thread's */
+	if (p->usr != r->current.usr) {
+		static struct oim_input input;
+		static float scratch[OIM__RELOAD_WARM_FRAMES * OIM_N_CHANNELS];
+		const uint32_t rate = oim__config.sample_rate * r->oversample_ratio;
+		memset(&input, 0, sizeof input);
+		if (r->planar) {
+			float* planes[OIM_N_CHANNELS];
+			for (int ch = 0; ch < OIM_N_CHANNELS; ch++) planes[ch] = &scratch[ch * OIM__RELOAD_WARM_FRAMES];
+			p->planar_fn(rate, OIM__RELOAD_WARM_FRAMES, planes, p->usr, &input);
+		} else {
+			p->process_fn(rate, OIM__RELOAD_WARM_FRAMES, scratch, p->usr, &input);
+		}
+	}
+	return 0;
+}
+
+/* the new version is in the layer; unloads the old one */
+static void oim__reload_retire(struct oim__reload* r)
+{
+	const struct oim__plugin old = r->current;
+	r->current = r->next;
+	if (r->current.retire != NULL && r->current.usr != old.usr && old.usr != r->run_usr) r->current.retire(old.usr);
+	if (old.handle != NULL) dlclose(old.handle);
+}
+
+static void oim__reload_apply(struct oim__layer* l, const struct oim__plugin* p)
+{
+	l->process_fn = p->process_fn;
+	l->planar_fn = p->planar_fn;
+	l->usr = p->usr;
+}
+
+/* the audio thread's half; called at the start of every period */
+static void oim__reload_take(struct oim__reload* r)
+{
+	if (__atomic_load_n(&r->pending, __ATOMIC_RELAXED) == NULL) return;
+	struct oim__plugin* p = __atomic_exchange_n(&r->pending, NULL, __ATOMIC_ACQUIRE);
+	oim__reload_apply(r->layer, p);
+	__atomic_add_fetch(&r->n_swapped, 1, __ATOMIC_RELEASE);
+	oim__futex_wake(&r->n_swapped);
+}
+
+/* blocks until the object has been written, and then until it's been
+ * quiet for a moment, as a build may write it more than once */
+static void oim__reload_watch(int fd, const char* name)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	int changed = 0;
+	for (;;) {
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+		if (poll(&pfd, 1, changed ? 200 : -1) == 0) return;
+		ssize_t n = read(fd, buf, sizeof buf);
+		for (char* p = buf; n > 0 && p < (buf + n); ) {
+			const struct inotify_event* ev = (const struct inotify_event*)p;
+			if (ev->len > 0 && strcmp(ev->name, name) == 0) changed = 1;
+			p += sizeof *ev + ev->len;
+		}
+	}
+}
+
+static void* oim__reload_thread(void* usr)
+{
+	struct oim__reload* r = usr;
+
+	char dir[PATH_MAX];
+	snprintf(dir, sizeof dir, "%s", r->path);
+	char* slash = strrchr(dir, '/');
+	const char* name = r->path;
+	if (slash == NULL) {
+		strcpy(dir, ".");
+	} else {
+		name += (slash - dir) + 1;
+		if (slash == dir) slash++;
+		*slash = 0;
+	}
+
+	int fd = inotify_init1(IN_CLOEXEC);
+	if (fd == -1 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+		fprintf(stderr, "reload: can't watch %s: %s\n", dir, strerror(errno));
+		return NULL;
+	}
+
+	for (;;) {
+		oim__reload_watch(fd, name);
+		const int64_t t0 = oim__now_ns();
+		if (oim__reload_load(r) != 0) continue;
+
+		uint32_t seen = __atomic_load_n(&r->n_swapped, __ATOMIC_ACQUIRE);
+		__atomic_store_n(&r->pending, &r->next, __ATOMIC_RELEASE);
+		while (__atomic_load_n(&r->n_swapped, __ATOMIC_ACQUIRE) == seen) oim__futex_wait(&r->n_swapped, seen);
+		oim__reload_retire(r);
+		fprintf(stderr, "reloaded %s in %.1fms\n", r->path, (double)(oim__now_ns() - t0) * 1e-6);
+	}
+	return NULL;
+}
+
+/* loads the object into the engine's main layer, before anything
+ * renders, and starts watching it. without the object, or a function of
+ * the right kind in it, the layer keeps the function it has until
+ * there's one */
+static void oim__reload_start(struct oim__reload* r, const char* path, struct oim__engine* e)
+{
+	memset(r, 0, sizeof *r);
+	if (e->main_layer < 0) {
+		fprintf(stderr, "--reload: no main layer to reload\n");
+		exit(EXIT_FAILURE);
+	}
+	r->path = path;
+	r->oversample_ratio = e->oversample_ratio;
+	r->layer = &e->layers[e->main_layer];
+	r->planar = r->layer->planar_fn != NULL;
+	r->current.process_fn = r->layer->process_fn;
+	r->current.planar_fn = r->layer->planar_fn;
+	r->current.usr = r->layer->usr;
+	r->run_usr = r->layer->usr;
+	if (oim__reload_load(r) == 0) {
+		oim__reload_apply(r->layer, &r->next);
+		oim__reload_retire(r);
+		fprintf(stderr, "loaded %s\n", path);
+	}
+
+	pthread_t thread;
+	int err = pthread_create(&thread, NULL, oim__reload_thread, r);
+	if (err != 0) {
+		fprintf(stderr, "pthread_create: %s\n", strerror(err));
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* audio output; the consumer side of the input queue. the engine, the
+ * input queue, stats and --adaptive are the same whatever the output
+ * is, and a backend only opens it, and takes each rendered period.
+ * --backend picks one:
+ *
+ *   alsa         an ALSA pcm, --pcm (the default)
+ *   null         renders, and throws it away
+ *   wav:<path>   a float wav file, written as it's rendered
+ *   shm:<name>   a ring in a shm object, for another process to read
+ *
+ * the ones that aren't alsa are paced by a timer, one period per
+ * period's worth of time, so they load the machine the way a device
+ * would, with no sound card */
+
+struct oim__audio;
+
+struct oim__backend {
+	const char* name;
+	/* sets sample_rate, period_size and buffer_size, and registers
+	 * whatever wakes it up with the loop; returns 0 on success */
+	int (*open)(struct oim__audio* au);
+	void (*close)(struct oim__audio* au);
+	/* called every time the loop wakes up */
+	void (*handle)(struct oim__audio* au);
+	/* renders a period, and hands it over */
+	void (*write)(struct oim__audio* au, int64_t t_block);
+};
+
+/* the shm ring. a reader maps the object, checks magic and version, and
+ * copies frames from its own position up to write_pos, then stores its
+ * position in read_pos. oim never waits for the reader: if it falls more
+ * than capacity frames behind, oim writes over what it hasn't read yet
+ * and counts an overrun, so a reader should check write_pos again after
+ * copying, and throw away anything older than write_pos - capacity */
+
+#define OIM__RING_MAGIC (0x6f696d72) // "oimr"
+#define OIM__RING_VERSION (1)
+#define OIM__RING_FRAMES (1<<16)
+
+struct oim__ring {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t sample_rate;
+	uint32_t n_channels;
+	uint64_t capacity; // in frames, a power of two
+	uint64_t n_overruns;
+	uint64_t write_pos __attribute__((aligned(64))); // frames written, ever
+	uint64_t read_pos __attribute__((aligned(64))); // frames read, ever; stored by the reader
+	float data[] __attribute__((aligned(64))); // frame i is at (i % capacity) * n_channels
+};
+
+struct oim__audio {
+	const struct oim__backend* backend;
+	const char* backend_arg;
+	int is_open;
+
+	unsigned int sample_rate;
+	snd_pcm_uframes_t period_size;
+	snd_pcm_uframes_t buffer_size;
+	struct oim__adaptive adaptive;
+	float* buffer;
+
+	snd_pcm_t* pcm;
+	int mmap_wanted;
+	int mmap_access;
+	int sample_bytes; // in what's rendered: 4 for floats, or the device's integer format
+	struct oim__quantizer quantizer;
+
+	int timer_fd;
+	struct oim__wav_writer* wav;
+	struct oim__ring* ring;
+
+	struct oim__engine engine;
+	struct oim_input input;
+	struct oim__input_queue* queue;
+	struct oim__stats* stats;
+	struct oim__reload* reload;
+
+	struct oim_loop* loop;
+	struct oim_source src;
+	int retry;
+	uint32_t hotplug_seen;
+	int64_t t_retry;
+};
+
+/* a closed device is reopened straight away (it was an error, or
+ * --adaptive wanting a new period size). if that fails, it's tried again
+ * when something appears in /dev, and once a second, as the pcm may well
+ * be a sound server's, with no device node to wait for */
+static void oim__audio_open(struct oim__audio* au)
+{
+	if (au->is_open) return;
+	const int64_t now = oim__now_ns();
+	if (!au->retry && au->hotplug_seen == au->loop->hotplug && now < au->t_retry) return;
+	au->retry = 0;
+	au->hotplug_seen = au->loop->hotplug;
+	au->t_retry = now + 1000000000LL;
+
+	au->period_size = oim__config.adaptive ? au->adaptive.period_size : oim__config.period_size;
+	au->engine.quantizer = NULL;
+	au->sample_bytes = sizeof(float);
+	if (au->backend->open(au) == 0) {
+		au->is_open = 1;
+		oim__engine_reset(&au->engine);
+		oim__stats_add(&au->stats->n_opens, 1);
+		oim__stats_set(&au->stats->sample_rate, au->sample_rate);
+		oim__stats_set(&au->stats->period_size, au->period_size);
+		oim__stats_set(&au->stats->buffer_size, au->buffer_size);
+	}
+}
+
+static void oim__audio_close(struct oim__audio* au)
+{
+	au->backend->close(au);
+	au->is_open = 0;
+	au->retry = 1;
+}
+
+static void oim__audio_handle(struct oim__audio* au)
+{
+	if (au->is_open) au->backend->handle(au);
+}
+
+/* renders n_frames frames starting block_offset frames into the current
+ * block into dst. the engine is sized for the largest period oim asks
+ * for, so a device that settled on a larger one gets it in pieces */
+static void oim__audio_render(struct oim__audio* au, int64_t t_block, int block_offset, int n_frames, void* dst)
+{
+	const double frame_ns = 1e9 / (double)au->sample_rate;
+	const int R = au->engine.oversample_ratio;
+	for (int done = 0; done < n_frames; ) {
+		int n = n_frames - done;
+		if (n > au->engine.max_frames) n = au->engine.max_frames;
+		oim__input_queue_consume(au->queue, &au->input, t_block + (int64_t)((block_offset + done) * frame_ns), frame_ns / R, n * R);
+
+		/*
+		printf("x=%.3f\ty=%.3f\tp=%.3f\n", au->input.pen_x, au->input.pen_y, au->input.pen_pressure);
+		if (au->input.n_note_events > 0) {
+			printf("%d note events\n", au->input.n_note_events);
+		}
+		*/
+
+		oim__engine_render(&au->engine, au->sample_rate, n, (uint8_t*)dst + done * OIM_N_CHANNELS * au->sample_bytes, &au->input);
+		done += n;
+	}
+}
+
+/* one period, which starts playing once the delay frames already queued
+ * ahead of it have played. events are played one buffer length after
+ * they were read, which is enough for any event read up until now */
+static void oim__audio_period(struct oim__audio* au, int64_t t_start, int64_t delay)
+{
+	const double frame_ns = 1e9 / (double)au->sample_rate;
+	const int64_t t_block = t_start + (int64_t)((double)(delay - (int64_t)au->buffer_size) * frame_ns);
+
+	struct oim__engine* e = &au->engine;
+	e->t_process = 0;
+	e->t_decimate = 0;
+	e->n_subnormal = 0;
+	if (au->reload != NULL) oim__reload_take(au->reload);
+
+	au->backend->write(au, t_block);
+
+	/* "write" is all of the period that wasn't rendering: device
+	 * calls, copying out, and taking input off the queue */
+	struct oim__stats* st = au->stats;
+	const int64_t t_period = oim__now_ns() - t_start;
+	const int64_t t_render = e->t_process + e->t_decimate;
+	oim__stats_time(st, OIM__STATS_PROCESS, e->t_process);
+	oim__stats_time(st, OIM__STATS_DECIMATE, e->t_decimate);
+	oim__stats_time(st, OIM__STATS_WRITE, t_period - t_render);
+	oim__stats_time(st, OIM__STATS_PERIOD, t_period);
+	if ((double)t_render > (OIM__STATS_SLOW_FRACTION * au->period_size * frame_ns)) oim__stats_add(&st->n_slow, 1);
+	if (e->n_subnormal > 0) oim__stats_add(&st->n_subnormal, 1);
+	oim__stats_add(&st->n_periods, 1);
+
+	oim__adaptive_tick(&au->adaptive);
+	if (au->adaptive.reopen && au->is_open) {
+		au->adaptive.reopen = 0;
+		oim__audio_close(au);
+	}
+}
+
+/* alsa */
+
+static void oim__alsa_close(struct oim__audio* au)
+{
+	oim_loop_remove(au->loop, &au->src);
+	snd_pcm_close(au->pcm);
+	au->pcm = NULL;
+}
+
+static int oim__alsa_open(struct oim__audio* au)
+{
+	au->mmap_access = au->mmap_wanted;
+	int bits;
+	oim__open_pcm(&au->pcm, &au->sample_rate, &au->period_size, &au->buffer_size, &au->mmap_access, &bits);
+	if (au->pcm == NULL) return -1;
+	if (bits > 0) {
+		oim__quantizer_init(&au->quantizer, bits, oim__config.dither);
+		au->engine.quantizer = &au->quantizer;
+		au->sample_bytes = bits / 8;
+	}
+	au->src.n_fds = snd_pcm_poll_descriptors(au->pcm, au->src.fds, OIM_SOURCE_MAX_FDS);
+	oim_loop_add(au->loop, &au->src);
+	return 0;
+}
+
+static void oim__audio_recover(struct oim__audio* au, const char* what, int err)
+{
+	fprintf(stderr, "%s: %s\n", what, snd_strerror(err));
+	oim__stats_add(err == -EPIPE ? &au->stats->n_xruns : &au->stats->n_errors, 1);
+	oim__adaptive_xrun(&au->adaptive);
+	if ((err = snd_pcm_prepare(au->pcm)) < 0) {
+		fprintf(stderr, "snd_pcm_prepare: %s\n", snd_strerror(err));
+		oim__audio_close(au);
+	}
+}
+
+/* renders straight into the device's ring buffer. if the device uses
+ * some other layout than plain interleaved floats, frames are rendered
+ * into the private buffer and copied over instead */
+static void oim__audio_write_mmap(struct oim__audio* au, int64_t t_block)
+{
+	int err;
+	snd_pcm_uframes_t done = 0;
+	while (done < au->period_size) {
+		snd_pcm_sframes_t avail = snd_pcm_avail_update(au->pcm);
+		if (avail < 0) {
+			oim__audio_recover(au, "snd_pcm_avail_update", avail);
+			return;
+		}
+
+		const snd_pcm_channel_area_t* areas;
+		snd_pcm_uframes_t offset;
+		snd_pcm_uframes_t frames = au->period_size - done;
+		if (frames > au->engine.max_frames) frames = au->engine.max_frames; // what au->buffer holds
+		if ((err = snd_pcm_mmap_begin(au->pcm, &areas, &offset, &frames)) < 0) {
+			oim__audio_recover(au, "snd_pcm_mmap_begin", err);
+			return;
+		}
+		if (frames == 0) break;
+
+		const int bytes = au->sample_bytes;
+		int interleaved = 1;
+		for (int ch = 0; ch < OIM_N_CHANNELS; ch++) {
+			if (areas[ch].addr != areas[0].addr || areas[ch].first != (ch * bytes * 8) || areas[ch].step != (OIM_N_CHANNELS * bytes * 8)) {
+				interleaved = 0;
+			}
+		}
+
+		if (interleaved) {
+			uint8_t* dst = (uint8_t*)areas[0].addr + offset * OIM_N_CHANNELS * bytes;
+			oim__audio_render(au, t_block, done, frames, dst);
+		} else {
+			oim__audio_render(au, t_block, done, frames, au->buffer);
+			for (int ch = 0; ch < OIM_N_CHANNELS; ch++) {
+				const snd_pcm_channel_area_t* a = &areas[ch];
+				uint8_t* base = (uint8_t*)a->addr + (a->first / 8) + offset * (a->step / 8);
+				const uint8_t* src = (const uint8_t*)au->buffer + ch * bytes;
+				for (int i = 0; i < frames; i++) {
+					memcpy(base + i * (a->step / 8), src + i * OIM_N_CHANNELS * bytes, bytes);
+				}
+			}
+		}
+
+		snd_pcm_sframes_t n_committed = snd_pcm_mmap_commit(au->pcm, offset, frames);
+		if (n_committed < 0 || n_committed != frames) {
+			oim__audio_recover(au, "snd_pcm_mmap_commit", n_committed < 0 ? n_committed : -EPIPE);
+			return;
+		}
+		done += frames;
+	}
+
+	/* unlike writei, committing doesn't necessarily start the stream */
+	if (snd_pcm_state(au->pcm) == SND_PCM_STATE_PREPARED) {
+		if ((err = snd_pcm_start(au->pcm)) < 0) oim__audio_recover(au, "snd_pcm_start", err);
+	}
+}
+
+static void oim__alsa_write(struct oim__audio* au, int64_t t_block)
+{
+	if (au->mmap_access) {
+		oim__audio_write_mmap(au, t_block);
+	} else {
+		for (snd_pcm_uframes_t done = 0; done < au->period_size; ) {
+			snd_pcm_uframes_t n = au->period_size - done;
+			if (n > au->engine.max_frames) n = au->engine.max_frames;
+			oim__audio_render(au, t_block, done, n, au->buffer);
+			snd_pcm_sframes_t n_frames = snd_pcm_writei(au->pcm, au->buffer, n);
+			if (n_frames < 0) {
+				oim__audio_recover(au, "snd_pcm_writei", n_frames);
+				return;
+			}
+			done += n;
+		}
+	}
+}
+
+static void oim__alsa_handle(struct oim__audio* au)
+{
+	int err;
+	unsigned short revents;
+	err = snd_pcm_poll_descriptors_revents(au->pcm, au->src.fds, au->src.n_fds, &revents);
+	if (err < 0) {
+		fprintf(stderr, "pcm revents error: %s\n", snd_strerror(err));
+		oim__audio_close(au);
+	} else if (revents & (POLLERR | POLLHUP)) {
+		fprintf(stderr, "pcm HUP\n");
+		oim__audio_close(au);
+	} else if (revents & POLLOUT) {
+		const int64_t t_start = oim__now_ns();
+		snd_pcm_sframes_t delay;
+		if (snd_pcm_delay(au->pcm, &delay) < 0) delay = au->buffer_size - au->period_size;
+		else oim__stats_fill(au->stats, delay, au->buffer_size);
+		oim__audio_period(au, t_start, delay);
+	}
+}
+
+static const struct oim__backend oim__backend_alsa = {
+	.name = "alsa",
+	.open = oim__alsa_open,
+	.close = oim__alsa_close,
+	.handle = oim__alsa_handle,
+	.write = oim__alsa_write,
+};
+
+/* the timer the other backends are paced by. it has no device queue
+ * to run ahead into, so it pretends to have one of buffer_size frames,
+ * kept full but for the period being rendered */
+
+static int oim__timer_open(struct oim__audio* au)
+{
+	assert(au->period_size <= au->engine.max_frames);
+	au->sample_rate = oim__config.sample_rate;
+	au->buffer_size = au->period_size * oim__config.n_periods;
+
+	au->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (au->timer_fd == -1) {
+		perror("timerfd_create");
+		return -1;
+	}
+	const int64_t period_ns = ((int64_t)au->period_size * 1000000000LL) / au->sample_rate;
+	struct itimerspec its;
+	memset(&its, 0, sizeof its);
+	its.it_interval.tv_sec = period_ns / 1000000000LL;
+	its.it_interval.tv_nsec = period_ns % 1000000000LL;
+	its.it_value = its.it_interval;
+	if (timerfd_settime(au->timer_fd, 0, &its, NULL) == -1) {
+		perror("timerfd_settime");
+		close(au->timer_fd);
+		au->timer_fd = -1;
+		return -1;
+	}
+	au->src.n_fds = 1;
+	au->src.fds[0].fd = au->timer_fd;
+	au->src.fds[0].events = POLLIN;
+	oim_loop_add(au->loop, &au->src);
+	fprintf(stderr, "%s open; sample rate = %u; period size = %lu\n", au->backend->name, au->sample_rate, au->period_size);
+	return 0;
+}
+
+static void oim__timer_close(struct oim__audio* au)
+{
+	oim_loop_remove(au->loop, &au->src);
+	close(au->timer_fd);
+	au->timer_fd = -1;
+}
+
+/* more than one expiry means periods went by without being rendered;
+ * they're counted as xruns and skipped, to stay in step with the clock */
+static void oim__timer_handle(struct oim__audio* au)
+{
+	if (!(au->src.fds[0].revents & POLLIN)) return;
+	uint64_t n;
+	if (read(au->timer_fd, &n, sizeof n) != sizeof n) return;
+	if (n > 1) {
+		oim__stats_add(&au->stats->n_xruns, n - 1);
+		oim__adaptive_xrun(&au->adaptive);
+	}
+	oim__audio_period(au, oim__now_ns(), au->buffer_size - au->period_size);
+}
+
+static void oim__null_write(struct oim__audio* au, int64_t t_block)
+{
+	oim__audio_render(au, t_block, 0, au->period_size, au->buffer);
+}
+
+static const struct oim__backend oim__backend_null = {
+	.name = "null",
+	.open = oim__timer_open,
+	.close = oim__timer_close,
+	.handle = oim__timer_handle,
+	.write = oim__null_write,
+};
+
+/* the wav file is created on the first open, and kept across reopens.
+ * the audio side only pushes periods into a preallocated ring; a thread
+ * of its own writes them out, so the disk can never hold up a period.
+ * it also patches the header's sizes once a second, and on close, so
+ * the file is whole however oim is stopped. if the ring fills up anyway,
+ * frames are dropped, and counted */
+
+#define OIM__WAV_CHUNK_FRAMES (256)
+#define OIM__WAV_RING_SZ (1<<9) // in chunks; 2.7s at 48kHz
+
+struct oim__wav_chunk {
+	uint32_t n_frames; // 0 asks for the header to be patched
+	float data[OIM__WAV_CHUNK_FRAMES * OIM_N_CHANNELS];
+};
+
+struct oim__wav_writer {
+	int fd;
+	const char* path;
+	unsigned int sample_rate;
+	uint64_t n_frames;
+	int64_t t_header;
+	struct oim__spsc ring;
+	uint32_t n_dropped; // in frames
+	uint32_t wake;
+	uint32_t sleeping;
+};
+
+static void oim__wav_patch_header(struct oim__wav_writer* w)
+{
+	uint8_t h[OIM__WAV_HEADER_SZ];
+	oim__wav_header(h, w->sample_rate, OIM_N_CHANNELS, w->n_frames);
+	if (pwrite(w->fd, h, sizeof h, 0) != sizeof h) {
+		fprintf(stderr, "%s: header: %s\n", w->path, strerror(errno));
+	}
+	w->t_header = oim__now_ns();
+}
+
+static void* oim__wav_thread(void* usr)
+{
+	struct oim__wav_writer* w = usr;
+	uint32_t n_dropped_seen = 0;
+	for (;;) {
+		const uint32_t seen = __atomic_load_n(&w->wake, __ATOMIC_ACQUIRE);
+		struct oim__wav_chunk* chunk;
+		while ((chunk = oim__spsc_peek(&w->ring)) != NULL) {
+			const size_t sz = chunk->n_frames * OIM_N_CHANNELS * sizeof *chunk->data;
+			ssize_t n = sz > 0 ? write(w->fd, chunk->data, sz) : 0;
+			if (n != (ssize_t)sz) {
+				fprintf(stderr, "%s: %s\n", w->path, n == -1 ? strerror(errno) : "short write");
+				if (n > 0) lseek(w->fd, -n, SEEK_CUR);
+			} else {
+				w->n_frames += chunk->n_frames;
+			}
+			const int patch = chunk->n_frames == 0;
+			oim__spsc_drop(&w->ring);
+			if (patch || (oim__now_ns() - w->t_header) >= 1000000000LL) oim__wav_patch_header(w);
+		}
+
+		const uint32_t n_dropped = __atomic_load_n(&w->n_dropped, __ATOMIC_RELAXED);
+		if (n_dropped != n_dropped_seen) {
+			fprintf(stderr, "%s: %u frames dropped\n", w->path, n_dropped - n_dropped_seen);
+			n_dropped_seen = n_dropped;
+		}
+
+		/* as with the capture writer, one of the two sides sees the other */
+		__atomic_store_n(&w->sleeping, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (oim__spsc_peek(&w->ring) == NULL) oim__futex_wait(&w->wake, seen);
+		__atomic_store_n(&w->sleeping, 0, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+static struct oim__wav_writer* oim__wav_start(const char* path, unsigned int sample_rate)
+{
+	struct oim__wav_writer* w = calloc(1, sizeof *w);
+	assert(w != NULL);
+	w->path = path;
+	w->sample_rate = sample_rate;
+	w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (w->fd == -1) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	oim__wav_patch_header(w);
+	lseek(w->fd, OIM__WAV_HEADER_SZ, SEEK_SET);
+	oim__spsc_init(&w->ring, sizeof(struct oim__wav_chunk), OIM__WAV_RING_SZ);
+	oim__lock(w->ring.data, sizeof(struct oim__wav_chunk) * OIM__WAV_RING_SZ, 1, "wav ring");
+
+	pthread_t thread;
+	int err = pthread_create(&thread, NULL, oim__wav_thread, w);
+	if (err != 0) {
+		fprintf(stderr, "pthread_create: %s\n", strerror(err));
+		exit(EXIT_FAILURE);
+	}
+	return w;
+}
+
+/* n_frames of 0 pushes a request to patch the header */
+static void oim__wav_push(struct oim__wav_writer* w, const float* buf, int n_frames)
+{
+	int done = 0;
+	do {
+		struct oim__wav_chunk chunk;
+		chunk.n_frames = (n_frames - done) < OIM__WAV_CHUNK_FRAMES ? (n_frames - done) : OIM__WAV_CHUNK_FRAMES;
+		if (chunk.n_frames > 0) memcpy(chunk.data, &buf[done * OIM_N_CHANNELS], chunk.n_frames * OIM_N_CHANNELS * sizeof *buf);
+		if (!oim__spsc_push(&w->ring, &chunk)) __atomic_add_fetch(&w->n_dropped, chunk.n_frames, __ATOMIC_RELAXED);
+		done += chunk.n_frames;
+	} while (done < n_frames);
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&w->sleeping, __ATOMIC_RELAXED)) {
+		__atomic_add_fetch(&w->wake, 1, __ATOMIC_RELAXED);
+		oim__futex_wake(&w->wake);
+	}
+}
+
+static int oim__wav_open(struct oim__audio* au)
+{
+	if (au->wav == NULL) {
+		au->sample_rate = oim__config.sample_rate;
+		au->wav = oim__wav_start(au->backend_arg, au->sample_rate);
+	}
+	return oim__timer_open(au);
+}
+
+static void oim__wav_close(struct oim__audio* au)
+{
+	oim__wav_push(au->wav, NULL, 0);
+	oim__timer_close(au);
+}
+
+static void oim__wav_write(struct oim__audio* au, int64_t t_block)
+{
+	oim__audio_render(au, t_block, 0, au->period_size, au->buffer);
+	oim__wav_push(au->wav, au->buffer, au->period_size);
+}
+
+static const struct oim__backend oim__backend_wav = {
+	.name = "wav",
+	.open = oim__wav_open,
+	.close = oim__wav_close,
+	.handle = oim__timer_handle,
+	.write = oim__wav_write,
+};
+
+/* the ring is set up on the first open, and kept across reopens */
+
+static int oim__shm_open(struct oim__audio* au)
+{
+	if (au->ring == NULL) {
+		const char* name = au->backend_arg;
+		const size_t sz = sizeof *au->ring + (size_t)OIM__RING_FRAMES * OIM_N_CHANNELS * sizeof(float);
+		int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+		if (fd == -1) {
+			fprintf(stderr, "shm_open %s: %s\n", name, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		if (ftruncate(fd, sz) == -1) {
+			fprintf(stderr, "ftruncate %s: %s\n", name, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		void* p = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED) {
+			fprintf(stderr, "mmap %s: %s\n", name, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		close(fd);
+		/* it's rendered into straight from the audio thread */
+		oim__lock(p, sz, 1, "shm ring");
+
+		struct oim__ring* r = p;
+		memset(r, 0, sizeof *r);
+		r->version = OIM__RING_VERSION;
+		r->sample_rate = oim__config.sample_rate;
+		r->n_channels = OIM_N_CHANNELS;
+		r->capacity = OIM__RING_FRAMES;
+		__atomic_store_n(&r->magic, OIM__RING_MAGIC, __ATOMIC_RELEASE);
+		au->ring = r;
+		fprintf(stderr, "writing audio to shm %s (%zu bytes, %d frames, version %d)\n", name, sz, OIM__RING_FRAMES, OIM__RING_VERSION);
+	}
+	return oim__timer_open(au);
+}
+
+static void oim__shm_write(struct oim__audio* au, int64_t t_block)
+{
+	struct oim__ring* r = au->ring;
+	const uint64_t w = r->write_pos;
+	const uint64_t rd = __atomic_load_n(&r->read_pos, __ATOMIC_ACQUIRE);
+	const uint64_t n = au->period_size;
+	/* until read_pos moves, there's no reader to overrun */
+	if (rd > 0 && (w - rd) > (r->capacity - n)) {
+		__atomic_store_n(&r->n_overruns, r->n_overruns + 1, __ATOMIC_RELAXED);
+	}
+	if (rd > 0) oim__stats_fill(au->stats, (w - rd) > r->capacity ? r->capacity : (w - rd), r->capacity);
+
+	/* rendered straight into the ring, in two pieces where it wraps */
+	const uint64_t at = w & (r->capacity - 1);
+	const uint64_t n0 = (r->capacity - at) < n ? (r->capacity - at) : n;
+	oim__audio_render(au, t_block, 0, n0, &r->data[at * OIM_N_CHANNELS]);
+	if (n0 < n) oim__audio_render(au, t_block, n0, n - n0, &r->data[0]);
+	__atomic_store_n(&r->write_pos, w + n, __ATOMIC_RELEASE);
+}
+
+static const struct oim__backend oim__backend_shm = {
+	.name = "shm",
+	.open = oim__shm_open,
+	.close = oim__timer_close,
+	.handle = oim__timer_handle,
+	.write = oim__shm_write,
+};
+
+static const struct oim__backend* oim__backends[] = {
+	&oim__backend_alsa,
+	&oim__backend_null,
+	&oim__backend_wav,
+	&oim__backend_shm,
+	NULL
+};
+
+/* parses --backend, <name>[:<arg>] */
+static const struct oim__backend* oim__backend_get(const char* spec, const char** arg)
+{
+	const char* colon = strchr(spec, ':');
+	const size_t n = colon != NULL ? (size_t)(colon - spec) : strlen(spec);
+	*arg = colon != NULL ? colon + 1 : NULL;
+	for (const struct oim__backend** b = oim__backends; *b != NULL; b++) {
+		if (strlen((*b)->name) != n || strncmp((*b)->name, spec, n) != 0) continue;
+		if ((*b == &oim__backend_wav || *b == &oim__backend_shm) && (*arg == NULL || **arg == 0)) {
+			fprintf(stderr, "--backend %s needs a %s, as %s:<%s>\n", (*b)->name, *b == &oim__backend_wav ? "path" : "name", (*b)->name, *b == &oim__backend_wav ? "path" : "name");
+			exit(EXIT_FAILURE);
+		}
+		return *b;
+	}
+	fprintf(stderr, "unknown backend: %s (alsa, null, wav:<path> or shm:<name>)\n", spec);
+	exit(EXIT_FAILURE);
+}
+
+static void oim__set_realtime_priority()
+{
+	const int priority = oim__config.rt_priority;
+
+	struct sched_param param;
+	memset(&param, 0, sizeof param);
+	param.sched_priority = priority;
+	int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (err != 0) {
+		fprintf(stderr, "SCHED_FIFO priority %d: %s; continuing without\n", priority, strerror(err));
+	} else {
+		fprintf(stderr, "audio thread running SCHED_FIFO at priority %d\n", priority);
+	}
+}
+
+void oim_run(int oversample_ratio, int oversample_zero_crossings, oim_process_fn process_fn, void* process_fn_usr)
+{
+	assert(oversample_ratio >= 1);
+	oim__init();
+
+	if (getenv("OIM_BENCH") != NULL) {
+		oim_bench(oversample_ratio, oversample_zero_crossings, process_fn, process_fn_usr);
+		return;
+	}
+
+	/* OIM_OFFLINE=<seconds> renders offline instead; see
+	 * oim_render_offline */
+	const char* offline = getenv("OIM_OFFLINE");
+	if (offline != NULL) {
+		oim_render_offline(
+			oversample_ratio,
+			oversample_zero_crossings,
+			process_fn,
+			process_fn_usr,
+			atof(offline),
+			getenv("OIM_OFFLINE_SCRIPT"),
+			getenv("OIM_OFFLINE_OUTPUT"));
+		return;
+	}
+
+	struct oim__input_queue queue;
+	oim__input_queue_init(&queue);
+
+	/* --input-thread moves input handling to a thread of its own, with
+	 * a loop of its own, and leaves this one waiting only on the pcm, at
+	 * realtime priority. otherwise everything is waited on from here.
+	 * --replay is the same, with a replay in place of the devices */
+	const int replaying = oim__config.replay != NULL;
+	const int threaded = oim__config.input_thread || replaying;
+	struct oim_loop loop;
+	struct oim_loop input_loop;
+	oim_loop_init(&loop);
+	if (threaded && !replaying) oim_loop_init(&input_loop);
+
+	struct oim__inputs inputs;
+	oim__inputs_init(&inputs, &queue, threaded ? &input_loop : &loop);
+	if (oim__config.capture != NULL) inputs.capture = oim__capture_start(oim__config.capture);
+
+	struct oim__replay replay;
+	if (replaying) oim__replay_open(&replay, oim__config.replay, &queue);
+
+	struct oim__audio audio;
+	memset(&audio, 0, sizeof audio);
+	audio.backend = oim__backend_get(oim__config.backend, &audio.backend_arg);
+	audio.queue = &queue;
+	audio.loop = &loop;
+	audio.retry = 1;
+	audio.timer_fd = -1;
+	audio.mmap_wanted = oim__config.mmap;
+	oim__adaptive_init(&audio.adaptive);
+	oim__engine_init(&audio.engine, oversample_ratio, oversample_zero_crossings, process_fn, process_fn_usr, oim__max_period_size(), 1);
+	audio.buffer = audio.engine.out;
+	fprintf(stderr, "audio memory: %zu KiB, for periods of up to %d frames\n", audio.engine.arena.size >> 10, audio.engine.max_frames);
+	oim__lock(oim__wavetables, sizeof(float) * OIM_N_WAVES * OIM__WAVETABLE_N_LEVELS * OIM__WAVETABLE_STRIDE, 0, "wavetables");
+	audio.engine.timed = 1;
+	fprintf(stderr, "simd kernels: %s\n", oim__k->name);
+
+	struct oim__reload reload;
+	if (oim__config.reload != NULL) {
+		oim__reload_start(&reload, oim__config.reload, &audio.engine);
+		audio.reload = &reload;
+	}
+
+	audio.stats = oim__stats_create();
+	if (oim__config.stats_interval > 0) {
+		pthread_t thread;
+		int err = pthread_create(&thread, NULL, oim__stats_thread, audio.stats);
+		if (err != 0) {
+			fprintf(stderr, "pthread_create: %s\n", strerror(err));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (threaded) {
+		pthread_t thread;
+		int err = replaying
+			? pthread_create(&thread, NULL, oim__replay_thread, &replay)
+			: pthread_create(&thread, NULL, oim__input_thread, &inputs);
+		if (err != 0) {
+			fprintf(stderr, "pthread_create: %s\n", strerror(err));
+			exit(EXIT_FAILURE);
+		}
+		oim__set_realtime_priority();
+	}
+
+	for (;;) {
+		oim__audio_open(&audio);
+		if (!threaded) oim__inputs_open(&inputs);
+
+		int err = oim_loop_wait(&loop, audio.is_open ? -1 : 1000);
+		if (err == 0) {
+			continue;
+		} else if (err == -1) {
+			perror("epoll_wait");
+			sleep(1);
+			continue;
+		}
+
+		if (!threaded) oim__inputs_handle(&inputs);
+		oim__audio_handle(&audio);
+	}
+}
+
+void oim_run_planar(int oversample_ratio, int oversample_zero_crossings, int n_channels, oim_planar_fn fn, void* usr)
+{
+	oim__layer_add(OIM__MIDI_CHANNEL_MAIN, NULL, fn, n_channels, usr);
+	oim_run(oversample_ratio, oversample_zero_crossings, NULL, NULL);
+}
+
+#ifdef OIM_PLUGIN
+/* the object has its own copy of everything in here, and oim_run isn't
+ * what runs it, so the loader calls this first. the math tables are
+ * small, and built here; the configuration and wavetables are the
+ * host's */
+__attribute__((visibility("default"))) int oim_plugin_attach(const struct oim__host* host)
+{
+	if (host->size != sizeof *host || host->config_size != sizeof oim__config) return -1;
+	oim__config = *host->config;
+	oim__config_ready = 1;
+	oim__math_init();
+	oim__wavetables = host->wavetables;
+	return 0;
+}
+#endif
@@ -0,0 +1,234 @@
+/* event loop, shared by oim.h and tablet-osc.c. a device's fds are
+ * registered with epoll once, when it's opened, and stay registered
+ * until it's closed, so nothing is rebuilt per iteration.
+ *
+ * devices that aren't there aren't retried on a timer either: inotify
+ * on /dev and /dev/snd bumps loop->hotplug whenever a node appears (or
+ * udev changes its permissions), and owners of missing devices retry
+ * opening them only when it changed. with no inotify, it's bumped once
+ * a second instead */
+
+#ifndef OIM_LOOP_H
+#define OIM_LOOP_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+
+#define OIM_SOURCE_MAX_FDS (8)
+#define OIM_LOOP_MAX_SOURCES (16)
+#define OIM_LOOP_MAX_EVENTS (32)
+
+/* the fds of one device; revents are filled in by oim_loop_wait, so
+ * that they can be handed to snd_*_poll_descriptors_revents and such */
+struct oim_source {
+	int n_fds;
+	struct pollfd fds[OIM_SOURCE_MAX_FDS];
+	int registered;
+};
+
+struct oim_loop {
+	int epfd;
+	int inotify_fd;
+	int wd_snd;
+	uint32_t hotplug;
+	int64_t t_recheck; // CLOCK_MONOTONIC ns of the last bump, with no inotify
+	int n_sources;
+	struct oim_source* sources[OIM_LOOP_MAX_SOURCES];
+};
+
+static uint32_t oim__poll_to_epoll(short events)
+{
+	uint32_t e = 0;
+	if (events & POLLIN) e |= EPOLLIN;
+	if (events & POLLOUT) e |= EPOLLOUT;
+	if (events & POLLPRI) e |= EPOLLPRI;
+	return e;
+}
+
+static short oim__epoll_to_poll(uint32_t events)
+{
+	short e = 0;
+	if (events & EPOLLIN) e |= POLLIN;
+	if (events & EPOLLOUT) e |= POLLOUT;
+	if (events & EPOLLPRI) e |= POLLPRI;
+	if (events & EPOLLERR) e |= POLLERR;
+	if (events & EPOLLHUP) e |= POLLHUP;
+	return e;
+}
+
+static int64_t oim__loop_now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void oim__loop_watch_snd(struct oim_loop* loop)
+{
+	if (loop->inotify_fd < 0 || loop->wd_snd >= 0) return;
+	loop->wd_snd = inotify_add_watch(loop->inotify_fd, "/dev/snd", IN_CREATE | IN_ATTRIB | IN_MOVED_TO);
+}
+
+static void oim_loop_init(struct oim_loop* loop)
+{
+	memset(loop, 0, sizeof *loop);
+	loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epfd == -1) {
+		perror("epoll_create1");
+		exit(EXIT_FAILURE);
+	}
+
+	loop->wd_snd = -1;
+	loop->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (loop->inotify_fd >= 0 && inotify_add_watch(loop->inotify_fd, "/dev", IN_CREATE | IN_ATTRIB | IN_MOVED_TO) < 0) {
+		close(loop->inotify_fd);
+		loop->inotify_fd = -1;
+	}
+	if (loop->inotify_fd < 0) {
+		fprintf(stderr, "no inotify on /dev (%s); looking for devices once a second\n", strerror(errno));
+		loop->t_recheck = oim__loop_now_ns();
+		return;
+	}
+	oim__loop_watch_snd(loop);
+
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof ev);
+	ev.events = EPOLLIN;
+	ev.data.u64 = UINT64_MAX;
+	epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->inotify_fd, &ev);
+}
+
+/* registers src->fds[0:n_fds] */
+static void oim_loop_add(struct oim_loop* loop, struct oim_source* src)
+{
+	if (loop->n_sources == OIM_LOOP_MAX_SOURCES) {
+		fprintf(stderr, "more than %d event sources\n", OIM_LOOP_MAX_SOURCES);
+		exit(EXIT_FAILURE);
+	}
+	const int s = loop->n_sources++;
+	loop->sources[s] = src;
+	for (int i = 0; i < src->n_fds; i++) {
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof ev);
+		ev.events = oim__poll_to_epoll(src->fds[i].events);
+		ev.data.u64 = ((uint64_t)s << 8) | (uint64_t)i;
+		if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, src->fds[i].fd, &ev) == -1) {
+			fprintf(stderr, "epoll_ctl add fd=%d: %s\n", src->fds[i].fd, strerror(errno));
+		}
+		src->fds[i].revents = 0;
+	}
+	src->registered = 1;
+}
+
+/* unregisters src; call before closing its fds */
+static void oim_loop_remove(struct oim_loop* loop, struct oim_source* src)
+{
+	if (!src->registered) return;
+	for (int i = 0; i < src->n_fds; i++) {
+		epoll_ctl(loop->epfd, EPOLL_CTL_DEL, src->fds[i].fd, NULL);
+		src->fds[i].revents = 0;
+	}
+	src->registered = 0;
+
+	/* the last source moves into the gap, so its fds are registered
+	 * again under their new index */
+	int s = 0;
+	while (loop->sources[s] != src) s++;
+	const int last = --loop->n_sources;
+	if (s != last) {
+		struct oim_source* moved = loop->sources[last];
+		loop->sources[s] = moved;
+		for (int i = 0; i < moved->n_fds; i++) {
+			struct epoll_event ev;
+			memset(&ev, 0, sizeof ev);
+			ev.events = oim__poll_to_epoll(moved->fds[i].events);
+			ev.data.u64 = ((uint64_t)s << 8) | (uint64_t)i;
+			epoll_ctl(loop->epfd, EPOLL_CTL_MOD, moved->fds[i].fd, &ev);
+		}
+	}
+}
+
+/* opens path into *fd, and registers it, unless it's open already */
+static void oim_loop_open_fd(struct oim_loop* loop, struct oim_source* src, int* fd, const char* path)
+{
+	if (*fd != -1) return;
+	*fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (*fd == -1) return;
+	fprintf(stderr, "open %s -> %d\n", path, *fd);
+	src->n_fds = 1;
+	src->fds[0].fd = *fd;
+	src->fds[0].events = POLLIN;
+	oim_loop_add(loop, src);
+}
+
+static void oim_loop_close_fd(struct oim_loop* loop, struct oim_source* src, int* fd)
+{
+	oim_loop_remove(loop, src);
+	close(*fd);
+	*fd = -1;
+}
+
+static void oim__loop_inotify(struct oim_loop* loop)
+{
+	/* what appeared doesn't matter, only that something did */
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t n;
+	while ((n = read(loop->inotify_fd, buf, sizeof buf)) > 0) {
+		for (char* p = buf; p < (buf + n); ) {
+			const struct inotify_event* ev = (const struct inotify_event*)p;
+			if (ev->len > 0 && strcmp(ev->name, "snd") == 0) oim__loop_watch_snd(loop);
+			p += sizeof *ev + ev->len;
+		}
+		loop->hotplug++;
+	}
+}
+
+/* waits up to timeout_ms (-1 for ever) for events on the registered
+ * sources, and fills in their revents. returns the number of events, or
+ * -1 on error */
+static int oim_loop_wait(struct oim_loop* loop, int timeout_ms)
+{
+	for (int s = 0; s < loop->n_sources; s++) {
+		struct oim_source* src = loop->sources[s];
+		for (int i = 0; i < src->n_fds; i++) src->fds[i].revents = 0;
+	}
+
+	if (loop->inotify_fd < 0 && (timeout_ms < 0 || timeout_ms > 1000)) timeout_ms = 1000;
+
+	struct epoll_event evs[OIM_LOOP_MAX_EVENTS];
+	int n = epoll_wait(loop->epfd, evs, OIM_LOOP_MAX_EVENTS, timeout_ms);
+	if (n == -1) return errno == EINTR ? 0 : -1;
+	/* by the clock, as a busy loop may never time out */
+	if (loop->inotify_fd < 0) {
+		const int64_t now = oim__loop_now_ns();
+		if ((now - loop->t_recheck) >= 1000000000LL) {
+			loop->hotplug++;
+			loop->t_recheck = now;
+		}
+	}
+
+	for (int i = 0; i < n; i++) {
+		const uint64_t u = evs[i].data.u64;
+		if (u == UINT64_MAX) {
+			oim__loop_inotify(loop);
+			continue;
+		}
+		const int s = (int)(u >> 8);
+		const int j = (int)(u & 0xff);
+		if (s < loop->n_sources && j < loop->sources[s]->n_fds) {
+			loop->sources[s]->fds[j].revents = oim__epoll_to_poll(evs[i].events);
+		}
+	}
+	return n;
+}
+
+#endif
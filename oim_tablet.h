@@ -0,0 +1,247 @@
+/* tablet input, shared by oim.h and tablet-osc.c: evdev events are
+ * assembled into pen and multitouch frames, which are only used once
+ * SYN_REPORT completes them */
+
+#ifndef OIM_TABLET_H
+#define OIM_TABLET_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+
+#define OIM_MAX_TOUCHES (16)
+
+/* an axis is scaled from the device's [min:max] to [0:1]. the ranges
+ * are read from the device when it opens; a capture records them then,
+ * so that replay scales the same way. without one, or if the device
+ * doesn't say, an axis gets [0:default_max] */
+
+struct oim__tablet_axis {
+	float min;
+	float scale;
+};
+
+static void oim__tablet_axis_set(struct oim__tablet_axis* a, int min, int max, int default_max)
+{
+	if (max > min) {
+		a->min = min;
+		a->scale = 1.0f / (float)(max - min);
+	} else {
+		a->min = 0;
+		a->scale = 1.0f / (float)default_max;
+	}
+}
+
+/* the range of one of fd's axes, or [0:0] if it can't be had */
+static void oim_tablet_absinfo(int fd, int code, int* min, int* max)
+{
+	struct input_absinfo abs;
+	*min = *max = 0;
+	if (fd >= 0 && ioctl(fd, EVIOCGABS(code), &abs) == 0) {
+		*min = abs.minimum;
+		*max = abs.maximum;
+	}
+}
+
+static float oim__tablet_axis(const struct oim__tablet_axis* a, int value)
+{
+	return ((float)value - a->min) * a->scale;
+}
+
+/* pen axes are collected into frames; a frame ends at SYN_REPORT, and
+ * only then is it applied, so x, y and pressure always come from the
+ * same report. SYN_DROPPED means the kernel's buffer overflowed; the
+ * rest of that frame is garbage, so it's thrown away, and the axes are
+ * read back from the device instead */
+
+#define OIM_PEN_N_AXES (3)
+static const int oim_pen_axes[OIM_PEN_N_AXES] = { ABS_X, ABS_Y, ABS_PRESSURE };
+
+struct oim_pen_frame {
+	float x;
+	float y;
+	float pressure;
+	int dropped;
+	struct oim__tablet_axis axis_x, axis_y, axis_pressure;
+};
+
+/* sets the range of the axis with that ABS_ code; ranges the device
+ * doesn't give are the original tablet's */
+static void oim_pen_frame_axis(struct oim_pen_frame* f, int code, int min, int max)
+{
+	switch (code) {
+	case ABS_X: oim__tablet_axis_set(&f->axis_x, min, max, 14720); break;
+	case ABS_Y: oim__tablet_axis_set(&f->axis_y, min, max, 9200); break;
+	case ABS_PRESSURE: oim__tablet_axis_set(&f->axis_pressure, min, max, 1023); break;
+	}
+}
+
+/* also called with fd -1, for replay */
+static void oim_pen_frame_init(struct oim_pen_frame* f, int fd)
+{
+	memset(f, 0, sizeof *f);
+	for (int i = 0; i < OIM_PEN_N_AXES; i++) {
+		int min, max;
+		oim_tablet_absinfo(fd, oim_pen_axes[i], &min, &max);
+		oim_pen_frame_axis(f, oim_pen_axes[i], min, max);
+	}
+}
+
+static void oim__pen_frame_resync(struct oim_pen_frame* f, int fd)
+{
+	struct input_absinfo abs;
+	if (ioctl(fd, EVIOCGABS(ABS_X), &abs) == 0) f->x = oim__tablet_axis(&f->axis_x, abs.value);
+	if (ioctl(fd, EVIOCGABS(ABS_Y), &abs) == 0) f->y = oim__tablet_axis(&f->axis_y, abs.value);
+	if (ioctl(fd, EVIOCGABS(ABS_PRESSURE), &abs) == 0) f->pressure = oim__tablet_axis(&f->axis_pressure, abs.value);
+}
+
+/* returns 1 when ev completes a frame */
+static int oim_pen_frame_event(struct oim_pen_frame* f, int fd, const struct input_event* ev)
+{
+	if (ev->type == EV_SYN) {
+		if (ev->code == SYN_DROPPED) {
+			f->dropped = 1;
+		} else if (ev->code == SYN_REPORT) {
+			if (f->dropped) {
+				f->dropped = 0;
+				if (fd >= 0) oim__pen_frame_resync(f, fd);
+			}
+			return 1;
+		}
+	} else if (ev->type == EV_ABS && !f->dropped) {
+		switch (ev->code) {
+		case ABS_X: f->x = oim__tablet_axis(&f->axis_x, ev->value); break;
+		case ABS_Y: f->y = oim__tablet_axis(&f->axis_y, ev->value); break;
+		case ABS_PRESSURE: f->pressure = oim__tablet_axis(&f->axis_pressure, ev->value); break;
+		case ABS_DISTANCE: break;
+		}
+	}
+	return 0;
+}
+
+/* multitouch, protocol B. ABS_MT_SLOT picks a slot, and only what
+ * changed in it follows; a tracking id of -1 lifts its finger. slots
+ * are updated as the events come in and marked dirty, and only dirty
+ * slots are copied out when SYN_REPORT ends the frame. after
+ * SYN_DROPPED, every slot is read back from the device instead */
+
+#define OIM__TOUCH_DEFAULT_MAX (4095)
+#define OIM_TOUCH_N_AXES (3)
+static const int oim_touch_axes[OIM_TOUCH_N_AXES] = { ABS_MT_POSITION_X, ABS_MT_POSITION_Y, ABS_MT_PRESSURE };
+
+struct oim_touch_frame {
+	int slot;
+	int dropped;
+	int has_pressure;
+	uint32_t active;
+	uint32_t dirty;
+	float x[OIM_MAX_TOUCHES];
+	float y[OIM_MAX_TOUCHES];
+	float pressure[OIM_MAX_TOUCHES];
+	struct oim__tablet_axis axis_x, axis_y, axis_pressure;
+};
+
+/* sets the range of the axis with that ABS_MT_ code */
+static void oim_touch_frame_axis(struct oim_touch_frame* f, int code, int min, int max)
+{
+	switch (code) {
+	case ABS_MT_POSITION_X: oim__tablet_axis_set(&f->axis_x, min, max, OIM__TOUCH_DEFAULT_MAX); break;
+	case ABS_MT_POSITION_Y: oim__tablet_axis_set(&f->axis_y, min, max, OIM__TOUCH_DEFAULT_MAX); break;
+	case ABS_MT_PRESSURE: oim__tablet_axis_set(&f->axis_pressure, min, max, OIM__TOUCH_DEFAULT_MAX); break;
+	}
+}
+
+/* also called with fd -1, for replay */
+static void oim_touch_frame_init(struct oim_touch_frame* f, int fd)
+{
+	memset(f, 0, sizeof *f);
+	for (int i = 0; i < OIM_TOUCH_N_AXES; i++) {
+		int min, max;
+		oim_tablet_absinfo(fd, oim_touch_axes[i], &min, &max);
+		oim_touch_frame_axis(f, oim_touch_axes[i], min, max);
+	}
+}
+
+static void oim__touch_frame_resync(struct oim_touch_frame* f, int fd)
+{
+	struct {
+		uint32_t code;
+		int32_t values[OIM_MAX_TOUCHES];
+	} mt;
+	struct input_absinfo abs;
+	if (ioctl(fd, EVIOCGABS(ABS_MT_SLOT), &abs) == 0) f->slot = abs.value;
+
+	/* a device with fewer slots only fills in as many */
+	memset(mt.values, 0xff, sizeof mt.values);
+	mt.code = ABS_MT_TRACKING_ID;
+	if (ioctl(fd, EVIOCGMTSLOTS(sizeof mt), &mt) == 0) {
+		f->active = 0;
+		for (int i = 0; i < OIM_MAX_TOUCHES; i++) {
+			if (mt.values[i] != -1) f->active |= 1u << i;
+		}
+	}
+	mt.code = ABS_MT_POSITION_X;
+	if (ioctl(fd, EVIOCGMTSLOTS(sizeof mt), &mt) == 0) {
+		for (int i = 0; i < OIM_MAX_TOUCHES; i++) f->x[i] = oim__tablet_axis(&f->axis_x, mt.values[i]);
+	}
+	mt.code = ABS_MT_POSITION_Y;
+	if (ioctl(fd, EVIOCGMTSLOTS(sizeof mt), &mt) == 0) {
+		for (int i = 0; i < OIM_MAX_TOUCHES; i++) f->y[i] = oim__tablet_axis(&f->axis_y, mt.values[i]);
+	}
+	mt.code = ABS_MT_PRESSURE;
+	if (ioctl(fd, EVIOCGMTSLOTS(sizeof mt), &mt) == 0) {
+		for (int i = 0; i < OIM_MAX_TOUCHES; i++) f->pressure[i] = oim__tablet_axis(&f->axis_pressure, mt.values[i]);
+	}
+	f->dirty = ~0u >> (32 - OIM_MAX_TOUCHES);
+}
+
+/* returns 1 when ev completes a frame that changed something */
+static int oim_touch_frame_event(struct oim_touch_frame* f, int fd, const struct input_event* ev)
+{
+	if (ev->type == EV_SYN) {
+		if (ev->code == SYN_DROPPED) {
+			f->dropped = 1;
+		} else if (ev->code == SYN_REPORT) {
+			if (f->dropped) {
+				f->dropped = 0;
+				if (fd >= 0) oim__touch_frame_resync(f, fd);
+			}
+			return f->dirty != 0;
+		}
+		return 0;
+	}
+	if (ev->type != EV_ABS || f->dropped) return 0;
+
+	if (ev->code == ABS_MT_SLOT) {
+		f->slot = ev->value;
+		return 0;
+	}
+	const int i = f->slot;
+	if (i < 0 || i >= OIM_MAX_TOUCHES) return 0;
+	switch (ev->code) {
+	case ABS_MT_TRACKING_ID:
+		if (ev->value == -1) f->active &= ~(1u << i);
+		else f->active |= 1u << i;
+		break;
+	case ABS_MT_POSITION_X: f->x[i] = oim__tablet_axis(&f->axis_x, ev->value); break;
+	case ABS_MT_POSITION_Y: f->y[i] = oim__tablet_axis(&f->axis_y, ev->value); break;
+	case ABS_MT_PRESSURE:
+		f->has_pressure = 1;
+		f->pressure[i] = oim__tablet_axis(&f->axis_pressure, ev->value);
+		break;
+	default:
+		return 0;
+	}
+	f->dirty |= 1u << i;
+	return 0;
+}
+
+/* every finger lifts when the device goes away */
+static void oim_touch_frame_release(struct oim_touch_frame* f)
+{
+	f->dirty |= f->active;
+	f->active = 0;
+}
+
+#endif
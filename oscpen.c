@@ -1,30 +1,38 @@
 #include "oim.h"
 
 struct state {
-	float phase, hz, gain, x;
+	float phase;
+	struct oim_smoother hz, gain, x;
 };
 
-static void process(uint32_t sample_rate, uint32_t n_frames, float* buffer, void* usr, struct oim_input* input)
+static void process(uint32_t sample_rate, uint32_t n_frames, float* const* channels, void* usr, struct oim_input* input)
 {
 	struct state* state = usr;
 
-	float target_hz = 660.0f * powf(2.0f, input->pen_x * 2);
+	float target_hz = 660.0f * oim_exp2(input->pen_x * 2);
 	float target_gain = input->pen_pressure;
 	float target_x = input->pen_y;
 
-	for (int i = 0; i < n_frames; i++) {
-		float signal0 = sinf(state->phase);
-		float signal1 = (state->phase - OIM_PI) / OIM_PI;
+	for (uint32_t i0 = 0; i0 < n_frames; i0 += OIM_KRATE_FRAMES) {
+		const int n = (n_frames - i0) < OIM_KRATE_FRAMES ? (n_frames - i0) : OIM_KRATE_FRAMES;
 
-		float signal = ((signal0 * state->x) + (signal1 * (1-state->x) * (1-state->x))) * state->gain;
+		/* pitch, and the wavetable level, at control rate */
+		const float dt = oim_smooth_k(&state->hz, sample_rate, target_hz, n) / (float)sample_rate;
+		const float* sine = oim_wavetable(OIM_WAVE_SINE, dt);
+		const float* saw = oim_wavetable(OIM_WAVE_SAW, dt);
 
-		for (int j = 0; j < OIM_N_CHANNELS; j++) buffer[i*OIM_N_CHANNELS+j] = signal;
+		float phase[OIM_KRATE_FRAMES], gain[OIM_KRATE_FRAMES], x[OIM_KRATE_FRAMES];
+		oim_phase_ramp(&state->phase, dt, phase, n);
+		oim_smooth(&state->gain, sample_rate, target_gain, gain, n);
+		oim_smooth(&state->x, sample_rate, target_x, x, n);
 
-		state->phase += (state->hz / (float)sample_rate) * OIM_PI2;
-		while (state->phase > OIM_PI2) state->phase -= OIM_PI2;
-		state->hz += (target_hz - state->hz) * 0.0001f;
-		state->gain += (target_gain - state->gain) * 0.0001f;
-		state->x += (target_x - state->x) * 0.0001f;
+		float* out = &channels[0][i0];
+		for (int i = 0; i < n; i++) {
+			float signal0 = oim_wavetable_read(sine, phase[i]);
+			float signal1 = oim_wavetable_read(saw, phase[i]);
+
+			out[i] = ((signal0 * x[i]) + (signal1 * (1-x[i]) * (1-x[i]))) * gain[i];
+		}
 	}
 }
 
@@ -32,7 +40,12 @@ int main(int argc, char** argv)
 {
 	struct state state;
 	memset(&state, 0, sizeof state);
-	oim_run(16, 3, process, &state);
+	oim_smoother_init(&state.hz, 0, 0.013f);
+	oim_smoother_init(&state.gain, 0, 0.013f);
+	oim_smoother_init(&state.x, 0, 0.013f);
+	oim_args(argc, argv);
+	oim_run_planar(2, 3, 1, process, &state);
 	return EXIT_SUCCESS;
 }
 
+OIM_EXPORT_PLANAR(process)
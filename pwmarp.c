@@ -8,77 +8,114 @@ pen pressure: gain
 */
 
 struct state {
-	float phase, arp_phase, arp_hz, gain, dutycycle;
+	float arp_phase;
+	int arp_note; // -1 when not playing
+	struct oim_smoother arp_hz, gain, dutycycle;
 
-	int n_notes;
-	uint8_t notes[256];
+	uint64_t held[2]; // bit per note
+	struct oim_voices voices;
 };
 
-static int arp_asc(const void* va, const void* vb)
+/* the lowest held note above after, wrapping around to the lowest held
+ * note overall; -1 if none are held */
+static int next_held(const struct state* state, int after)
 {
-	return *((uint8_t*)va) - *((uint8_t*)vb);
+	int from = after + 1;
+	for (int k = 0; k < 3; k++) {
+		int w = (from >> 6) & 1;
+		uint64_t bits = state->held[w] & (from & 63 ? ~0ULL << (from & 63) : ~0ULL);
+		if (from < 128 && bits) return (w << 6) + __builtin_ctzll(bits);
+		from = from < 64 ? 64 : 0;
+	}
+	return -1;
 }
 
-static void process(uint32_t sample_rate, uint32_t n_frames, float* buffer, void* usr, struct oim_input* input)
+static void arp_step(struct state* state, uint32_t sample_rate)
 {
-	struct state* state = usr;
+	int note = next_held(state, state->arp_note);
+	if (state->arp_note >= 0) oim_voices_note_off(&state->voices, state->arp_note);
+	if (note >= 0) oim_voices_note_on(&state->voices, sample_rate, note, 1.0f);
+	state->arp_note = note;
+}
 
-	for (int i = 0; i < input->n_note_events; i++) {
-		struct oim_note_event ev = input->note_events[i];
-		uint8_t ev_note = ev.note;
-		if (ev.velocity > 0) {
-			state->notes[state->n_notes++] = ev_note;
-			qsort(state->notes, state->n_notes, sizeof *state->notes, arp_asc);
-		} else {
-			int c = 0;
-			for (int j = 0; j < state->n_notes; j++) {
-				uint8_t note = state->notes[j];
-				if (note != ev_note) state->notes[c++] = note;
-			}
-			state->n_notes = c;
+static void note_event(struct state* state, uint32_t sample_rate, struct oim_note_event ev)
+{
+	uint64_t bit = 1ULL << (ev.note & 63);
+	if (ev.velocity > 0) {
+		state->held[ev.note >> 6] |= bit;
+		if (state->arp_note < 0) arp_step(state, sample_rate);
+	} else {
+		state->held[ev.note >> 6] &= ~bit;
+		if (ev.note == state->arp_note) {
+			oim_voices_note_off(&state->voices, ev.note);
+			state->arp_note = -1;
+			arp_step(state, sample_rate);
 		}
 	}
+}
 
-	float target_arp_hz = (100.0f / 32.0f) * powf(2.0f, input->pen_x * 5);
-	float target_dutycycle = input->pen_y;
-	float target_gain = input->pen_pressure;
-
+static inline float pulse(float phase, float dt, float duty)
+{
+	return oim_osc_pulse(phase, dt, duty);
+}
 
-	for (int i = 0; i < n_frames; i++) {
-		if (state->n_notes > 0) {
-			float signal = (state->phase < state->dutycycle) ? state->gain : -state->gain;
+static void render(struct state* state, uint32_t sample_rate, int begin, int end, float* buffer, float target_arp_hz, float target_dutycycle, float target_gain)
+{
+	for (int i0 = begin; i0 < end; i0 += OIM_KRATE_FRAMES) {
+		const int n = (end - i0) < OIM_KRATE_FRAMES ? (end - i0) : OIM_KRATE_FRAMES;
+
+		/* the arpeggio steps at control rate */
+		state->arp_phase += oim_smooth_k(&state->arp_hz, sample_rate, target_arp_hz, n) * (float)n / (float)sample_rate;
+		if (state->arp_phase >= 1.0f) {
+			state->arp_phase -= (float)(int)state->arp_phase;
+			arp_step(state, sample_rate);
+		}
 
-			for (int j = 0; j < OIM_N_CHANNELS; j++) buffer[i*OIM_N_CHANNELS+j] = signal;
+		float gain[OIM_KRATE_FRAMES], duty[OIM_KRATE_FRAMES];
+		oim_smooth(&state->gain, sample_rate, target_gain, gain, n);
+		oim_smooth(&state->dutycycle, sample_rate, target_dutycycle, duty, n);
 
-			const float arp_adv = state->arp_hz / (float)sample_rate;
-			state->arp_phase += arp_adv;
-			int arp_index = (int)state->arp_phase;
-			if (arp_index >= state->n_notes) {
-				state->arp_phase -= (float)arp_index;
-				arp_index = 0;
-			}
-			uint8_t note = state->notes[arp_index];
-			float hz = 440.0f * powf(2.0f, (float)(note - 69) / 12.0f);
+		float* out = &buffer[i0];
+		for (int i = 0; i < n; i++) {
+			duty[i] = (1.0f + duty[i]) * 0.5f;
+			out[i] = 0;
+		}
+		oim_voices_render(&state->voices, sample_rate, pulse, 1.0f, duty, out, n);
+		for (int i = 0; i < n; i++) out[i] *= gain[i];
+	}
+}
 
-			state->phase += (hz / (float)sample_rate) * 2.0f;
-			while (state->phase > 1.0f) state->phase -= 2.0f;
+static void process(uint32_t sample_rate, uint32_t n_frames, float* const* channels, void* usr, struct oim_input* input)
+{
+	struct state* state = usr;
 
-		} else {
-			for (int j = 0; j < OIM_N_CHANNELS; j++) buffer[i*OIM_N_CHANNELS+j] = 0;
-		}
+	float target_arp_hz = (100.0f / 32.0f) * oim_exp2(input->pen_x * 5);
+	float target_dutycycle = input->pen_y;
+	float target_gain = input->pen_pressure;
 
-		state->arp_hz += (target_arp_hz - state->arp_hz) * 0.0001f;
-		state->gain += (target_gain - state->gain) * 0.0001f;
-		state->dutycycle += (target_dutycycle - state->dutycycle) * 0.0001f;
+	/* render up to each note event, then apply it */
+	int i = 0;
+	for (int e = 0; e <= input->n_note_events; e++) {
+		int end = e < input->n_note_events ? input->note_events[e].frame : n_frames;
+		if (end > n_frames) end = n_frames;
+		render(state, sample_rate, i, end, channels[0], target_arp_hz, target_dutycycle, target_gain);
+		if (e < input->n_note_events) note_event(state, sample_rate, input->note_events[e]);
+		if (end > i) i = end;
 	}
 }
 
 int main(int argc, char** argv)
 {
-	struct state state;
+	static struct state state;
 	memset(&state, 0, sizeof state);
-	oim_run(10, 2, process, &state);
+	state.arp_note = -1;
+	oim_smoother_init(&state.arp_hz, 0, 0.021f);
+	oim_smoother_init(&state.gain, 0, 0.021f);
+	oim_smoother_init(&state.dutycycle, 0, 0.021f);
+	oim_voices_init(&state.voices, 0.002f, 0.005f);
+	oim_args(argc, argv);
+	oim_run_planar(2, 3, 1, process, &state);
 	return EXIT_SUCCESS;
 }
 
-
+OIM_EXPORT_PLANAR(process)
@@ -1,28 +1,32 @@
 #include "oim.h"
 
 struct state {
-	float phase, hz, gain, dutycycle;
+	float phase;
+	struct oim_smoother hz, gain, dutycycle;
 };
 
-static void process(uint32_t sample_rate, uint32_t n_frames, float* buffer, void* usr, struct oim_input* input)
+static void process(uint32_t sample_rate, uint32_t n_frames, float* const* channels, void* usr, struct oim_input* input)
 {
 	struct state* state = usr;
 
-	float target_hz = 50.0f * powf(2.0f, input->pen_x * 4);
+	float target_hz = 50.0f * oim_exp2(input->pen_x * 4);
 	float target_gain = input->pen_pressure;
 	float target_dutycycle = input->pen_y;
 
+	for (uint32_t i0 = 0; i0 < n_frames; i0 += OIM_KRATE_FRAMES) {
+		const int n = (n_frames - i0) < OIM_KRATE_FRAMES ? (n_frames - i0) : OIM_KRATE_FRAMES;
 
-	for (int i = 0; i < n_frames; i++) {
-		float signal = (state->phase < state->dutycycle) ? state->gain : -state->gain;
+		const float dt = oim_smooth_k(&state->hz, sample_rate, target_hz, n) / (float)sample_rate;
 
-		for (int j = 0; j < OIM_N_CHANNELS; j++) buffer[i*OIM_N_CHANNELS+j] = signal;
+		float phase[OIM_KRATE_FRAMES], gain[OIM_KRATE_FRAMES], dutycycle[OIM_KRATE_FRAMES];
+		oim_phase_ramp(&state->phase, dt, phase, n);
+		oim_smooth(&state->gain, sample_rate, target_gain, gain, n);
+		oim_smooth(&state->dutycycle, sample_rate, target_dutycycle, dutycycle, n);
 
-		state->phase += (state->hz / (float)sample_rate) * 2.0f;
-		while (state->phase > 1.0f) state->phase -= 2.0f;
-		state->hz += (target_hz - state->hz) * 0.0001f;
-		state->gain += (target_gain - state->gain) * 0.0001f;
-		state->dutycycle += (target_dutycycle - state->dutycycle) * 0.0001f;
+		float* out = &channels[0][i0];
+		for (int i = 0; i < n; i++) {
+			out[i] = oim_osc_pulse(phase[i], dt, (1.0f + dutycycle[i]) * 0.5f) * gain[i];
+		}
 	}
 }
 
@@ -30,7 +34,12 @@ int main(int argc, char** argv)
 {
 	struct state state;
 	memset(&state, 0, sizeof state);
-	oim_run(10, 2, process, &state);
+	oim_smoother_init(&state.hz, 0, 0.021f);
+	oim_smoother_init(&state.gain, 0, 0.021f);
+	oim_smoother_init(&state.dutycycle, 0, 0.021f);
+	oim_args(argc, argv);
+	oim_run_planar(2, 3, 1, process, &state);
 	return EXIT_SUCCESS;
 }
 
+OIM_EXPORT_PLANAR(process)
@@ -6,16 +6,20 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/ioctl.h>
 #include <unistd.h>
 #include <poll.h>
 #include <linux/input.h>
 #include <errno.h>
 
+#include "oim_loop.h"
+#include "oim_tablet.h"
+
 int osc_fd;
 int osc_buffer_length;
 uint8_t osc_buffer[2048];
 
-#define MAX_POLLFD (32)
+#define MAX_INPUT_EVENTS (64)
 
 static void osc_open(char* host, char* service)
 {
@@ -76,6 +80,11 @@ static void osc_f32(float f)
 	for (int i = 0; i < 4; i++) osc_buffer[osc_buffer_length++] = v.b[3 - i];
 }
 
+static void osc_i32(int32_t i)
+{
+	for (int j = 0; j < 4; j++) osc_buffer[osc_buffer_length++] = ((uint32_t)i >> (24 - j*8)) & 0xff;
+}
+
 static void osc_end()
 {
 	if (osc_buffer_length == 0) return;
@@ -85,38 +94,48 @@ static void osc_end()
 	osc_buffer_length = 0;
 }
 
-static void prep_fd_at_path_for_poll(int* fd, const char* path, int* n_pollfds, struct pollfd* pollfds) {
-	if (*fd == -1) {
-		*fd = open(path, O_RDONLY);
-		if (*fd != -1) fprintf(stderr, "open %s -> %d\n", path, *fd);
-	}
-	if (*fd >= 0) {
-		pollfds[*n_pollfds].fd = *fd;
-		pollfds[*n_pollfds].events = POLLIN;
-		(*n_pollfds)++;
-	}
-}
-
-static inline int handle_input_event(int* fd, struct pollfd* event, struct input_event* ev) {
-	if (event->fd != *fd) return 0;
+/* reads every pending event (up to max) in one go; returns the number
+ * of events read */
+static inline int handle_input_events(struct oim_loop* loop, struct oim_source* src, int* fd, struct input_event* evs, int max) {
+	if (*fd == -1) return 0;
 
-	if (event->revents & (POLLERR | POLLHUP)) {
+	const short revents = src->fds[0].revents;
+	if (revents & (POLLERR | POLLHUP)) {
 		fprintf(stderr, "input event fd=%d HUP\n", *fd);
-		close(*fd);
-		*fd = -1;
+		oim_loop_close_fd(loop, src, fd);
 		return 0;
-	} else if (!(event->revents & POLLIN)) {
+	} else if (!(revents & POLLIN)) {
 		return 0;
 	}
 
-	int n = read(*fd, ev, sizeof *ev);
-	if (n != sizeof *ev) {
+	ssize_t n = read(*fd, evs, max * sizeof *evs);
+	if (n <= 0 || (n % sizeof *evs) != 0) {
 		fprintf(stderr, "input event fd=%d read error: %s\n", *fd, n == -1 ? strerror(errno) : "wrong size");
-		close(*fd);
+		oim_loop_close_fd(loop, src, fd);
 		return 0;
 	} else {
-		return 1;
+		return n / sizeof *evs;
+	}
+}
+
+/* the slots that changed in a touch frame, as /tablet/touch ,ifff slot
+ * x y pressure. pressure is 1 while a finger is down if the device
+ * doesn't report it, and 0 once it's lifted */
+static void touch_frame_send(struct oim_touch_frame* f)
+{
+	for (uint32_t d = f->dirty; d != 0; d &= d - 1) {
+		const int i = __builtin_ctz(d);
+		const int down = (f->active >> i) & 1;
+		osc_begin();
+		osc_str("/tablet/touch");
+		osc_str(",ifff");
+		osc_i32(i);
+		osc_f32(f->x[i]);
+		osc_f32(f->y[i]);
+		osc_f32(down ? (f->has_pressure ? f->pressure[i] : 1.0f) : 0.0f);
+		osc_end();
 	}
+	f->dirty = 0;
 }
 
 
@@ -128,61 +147,81 @@ int main(int argc, char** argv)
 	}
 	osc_open(argv[1], argv[2]);
 
+	struct oim_loop loop;
+	oim_loop_init(&loop);
+	uint32_t hotplug_seen = loop.hotplug - 1;
+
 	int fd_pen = -1;
 	int fd_touch = -1;
 	int fd_padbtns = -1;
-
+	struct oim_source src_pen;
+	struct oim_source src_touch;
+	struct oim_source src_padbtns;
+	memset(&src_pen, 0, sizeof src_pen);
+	memset(&src_touch, 0, sizeof src_touch);
+	memset(&src_padbtns, 0, sizeof src_padbtns);
+
+	/* the last complete frame */
 	float pen_x = 0;
 	float pen_y = 0;
 	float pen_pressure = 0;
+	struct oim_pen_frame pen;
+	oim_pen_frame_init(&pen, -1);
+	struct oim_touch_frame touch;
+	memset(&touch, 0, sizeof touch);
 
 	for (;;) {
 		int err;
-		int n_pollfds = 0;
-		struct pollfd pollfds[MAX_POLLFD];
-
-		prep_fd_at_path_for_poll(&fd_pen,     "/dev/tablet_pen",     &n_pollfds, pollfds);
-		prep_fd_at_path_for_poll(&fd_touch,   "/dev/tablet_touch",   &n_pollfds, pollfds);
-		prep_fd_at_path_for_poll(&fd_padbtns, "/dev/tablet_padbtns", &n_pollfds, pollfds);
 
-		int n_simple_pollfds = n_pollfds;
+		/* devices are only looked for when something appeared in /dev */
+		if (hotplug_seen != loop.hotplug) {
+			hotplug_seen = loop.hotplug;
+			if (fd_pen == -1) {
+				oim_loop_open_fd(&loop, &src_pen, &fd_pen, "/dev/tablet_pen");
+				if (fd_pen != -1) oim_pen_frame_init(&pen, fd_pen);
+			}
+			if (fd_touch == -1) {
+				oim_loop_open_fd(&loop, &src_touch, &fd_touch, "/dev/tablet_touch");
+				if (fd_touch != -1) oim_touch_frame_init(&touch, fd_touch);
+			}
+			oim_loop_open_fd(&loop, &src_padbtns, &fd_padbtns, "/dev/tablet_padbtns");
+		}
 
-		err = poll(pollfds, n_pollfds, 10);
+		/* the pen's state is sent every 10ms while there is a pen; with
+		 * no pen there's nothing to send, so wait for one */
+		err = oim_loop_wait(&loop, fd_pen == -1 ? -1 : 10);
 		if (err == -1) {
-			perror("poll");
+			perror("epoll_wait");
 			sleep(1);
 			continue;
 		}
 
-		for (int i = 0; i < n_simple_pollfds; i++) {
-			struct pollfd* event = &pollfds[i];
-			if (event->revents == 0) continue;
-
-			struct input_event ev;
-			if (handle_input_event(&fd_pen, event, &ev)) {
-				if (ev.type == EV_ABS) {
-					if (ev.code == ABS_X) {
-						/* range = [0:14720] */
-						pen_x = (float)ev.value / 14720.0f;
-					} else if (ev.code == ABS_Y) {
-						/* range = [0:9200] */
-						pen_y = (float)ev.value / 9200.0f;
-					} else if (ev.code == ABS_PRESSURE) {
-						/* range = [0:1023] */
-						pen_pressure = (float)ev.value / 1023.0f;
-					} else if (ev.code == ABS_DISTANCE) {
-						/* range = [0:31] */
-					}
-
+		{
+			struct input_event evs[MAX_INPUT_EVENTS];
+			int n;
+
+			const int fd = fd_pen;
+			n = handle_input_events(&loop, &src_pen, &fd_pen, evs, MAX_INPUT_EVENTS);
+			for (int j = 0; j < n; j++) {
+				if (oim_pen_frame_event(&pen, fd, &evs[j])) {
+					pen_x = pen.x;
+					pen_y = pen.y;
+					pen_pressure = pen.pressure;
 				}
 			}
 
-			if (handle_input_event(&fd_touch, event, &ev)) {
+			const int fd_t = fd_touch;
+			n = handle_input_events(&loop, &src_touch, &fd_touch, evs, MAX_INPUT_EVENTS);
+			for (int j = 0; j < n; j++) {
+				if (oim_touch_frame_event(&touch, fd_t, &evs[j])) touch_frame_send(&touch);
 			}
-
-			if (handle_input_event(&fd_padbtns, event, &ev)) {
+			if (fd_t != -1 && fd_touch == -1) {
+				oim_touch_frame_release(&touch);
+				touch_frame_send(&touch);
 			}
+			handle_input_events(&loop, &src_padbtns, &fd_padbtns, evs, MAX_INPUT_EVENTS);
 		}
+		if (fd_pen == -1) continue;
 
 		osc_begin();
 		osc_str("/tablet");